@@ -3,7 +3,11 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <optional>
+#include <utility>
 #include <libsdb/types.hpp>
+#include <libsdb/expression.hpp>
+#include <libsdb/tracepoint.hpp>
 
 namespace sdb {
     class process;
@@ -33,6 +37,32 @@ namespace sdb {
             bool is_hardware() const { return is_hardware_; }
             bool is_internal() const { return is_internal_; }
 
+            // Hits where the condition is false are resumed by the process
+            // without being reported
+            const std::optional<expression>& condition() const {
+                return condition_;
+            }
+            void set_condition(std::optional<expression> condition) {
+                condition_ = std::move(condition);
+            }
+
+            // Tracepoints record their hits with the process instead of
+            // stopping
+            bool is_tracepoint() const { return trace_action_.has_value(); }
+            const std::optional<trace_action>& get_trace_action() const {
+                return trace_action_;
+            }
+            void set_trace_action(std::optional<trace_action> action) {
+                trace_action_ = std::move(action);
+            }
+
+            // Hits for which the condition held, including ignored ones
+            std::uint64_t hit_count() const { return hit_count_; }
+            void reset_hit_count() { hit_count_ = 0; }
+            // The next n hits are counted but not reported
+            std::uint64_t ignore_count() const { return ignore_count_; }
+            void set_ignore_count(std::uint64_t n) { ignore_count_ = n; }
+
         private:
             breakpoint_site(
                 process& proc, virt_addr address,
@@ -46,7 +76,10 @@ namespace sdb {
             std::byte saved_data_;
             bool is_hardware_;
             bool is_internal_;
-            int hardware_register_index_ = -1;
+            std::optional<expression> condition_;
+            std::optional<trace_action> trace_action_;
+            std::uint64_t hit_count_ = 0;
+            std::uint64_t ignore_count_ = 0;
     };
 }
 
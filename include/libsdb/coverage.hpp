@@ -0,0 +1,64 @@
+#ifndef SDB_COVERAGE_HPP
+#define SDB_COVERAGE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#include <libsdb/process.hpp>
+
+namespace sdb {
+    // Basic block coverage from one-shot breakpoints: every block start
+    // gets an internal breakpoint which is removed the first time it is
+    // hit, so code which has already run carries no further overhead
+    class coverage {
+        public:
+            coverage() = delete;
+            coverage(const coverage&) = delete;
+            coverage& operator=(const coverage&) = delete;
+
+            explicit coverage(process& proc) : process_(&proc) {}
+
+            // Block starts found by a linear sweep of [low, high): the
+            // first instruction, anything after a branch, call, ret or
+            // syscall, and the targets of direct branches
+            static std::vector<virt_addr> find_basic_blocks(
+                process& proc, virt_addr low, virt_addr high);
+
+            // Plants breakpoints on the blocks of every executable mapping
+            // of the given file, by default the main executable
+            void instrument(
+                std::optional<std::filesystem::path> file = std::nullopt);
+            void instrument(virt_addr low, virt_addr high);
+
+            // Resumes the process until it exits, passing on any signals
+            stop_reason run();
+            // Returns false if the stop wasn't for one of our breakpoints
+            bool record(const stop_reason& reason);
+
+            // Sorted block starts; bit i of the bitmap is for blocks()[i]
+            const std::vector<virt_addr>& blocks() const { return blocks_; }
+            bool is_covered(std::size_t index) const {
+                return (bitmap_[index / 8] >> (index % 8)) & 1;
+            }
+            std::size_t covered_count() const { return covered_; }
+
+            // One bit per block, least significant bit first
+            const std::vector<std::uint8_t>& bitmap() const {
+                return bitmap_;
+            }
+            void write_bitmap(std::ostream& out) const;
+
+        private:
+            std::optional<std::size_t> index_of(virt_addr address) const;
+
+            process* process_;
+            std::vector<virt_addr> blocks_;
+            std::vector<std::uint8_t> bitmap_;
+            std::size_t covered_ = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef SDB_DEBUG_REGISTERS_HPP
+#define SDB_DEBUG_REGISTERS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <variant>
+#include <vector>
+
+#include <libsdb/types.hpp>
+#include <libsdb/breakpoint_site.hpp>
+#include <libsdb/watchpoint.hpp>
+
+namespace sdb {
+    // Breakpoint sites and watchpoints number their ids separately
+    using hardware_stoppoint_id =
+        std::variant<breakpoint_site::id_type, watchpoint::id_type>;
+
+    // A stoppoint which wants a debug register
+    struct hardware_stoppoint_request {
+        hardware_stoppoint_id owner;
+        virt_addr address;
+        stoppoint_mode mode;
+        std::size_t size;
+    };
+
+    inline bool operator==(const hardware_stoppoint_request& lhs,
+        const hardware_stoppoint_request& rhs) {
+        return lhs.owner == rhs.owner and lhs.address == rhs.address and
+            lhs.mode == rhs.mode and lhs.size == rhs.size;
+    }
+
+    // Shares the four debug registers among any number of hardware
+    // stoppoints. Write requests whose ranges overlap or touch are packed
+    // into one register when together they still make an aligned 1, 2, 4
+    // or 8 bytes; other requests only share with those for the same bytes.
+    // When there are more registers' worth, those hit most often lately get
+    // them, and the process has to catch the rest some other way.
+    class debug_register_allocator {
+        public:
+            static constexpr std::size_t slot_count = 4;
+
+            struct slot {
+                virt_addr address;
+                stoppoint_mode mode;
+                std::size_t size;
+                std::vector<hardware_stoppoint_id> owners;
+            };
+
+            void add(hardware_stoppoint_request request);
+            void remove(hardware_stoppoint_id owner);
+            void clear() { entries_.clear(); slots_ = {}; }
+
+            void record_hit(hardware_stoppoint_id owner);
+
+            // Repacks the requests and picks which get a register, ageing
+            // the hits recorded so far. Slots which survive keep their
+            // index. Returns whether any slot changed
+            bool assign();
+
+            // Indexed by debug register, as of the last assign()
+            const std::array<std::optional<slot>, slot_count>& slots() const {
+                return slots_;
+            }
+            bool is_resident(hardware_stoppoint_id owner) const;
+            std::vector<hardware_stoppoint_request> non_resident() const;
+
+            std::size_t size() const { return entries_.size(); }
+
+        private:
+            struct entry {
+                hardware_stoppoint_request request;
+                // Hits since the last assign(), and a decaying sum of
+                // those before
+                std::uint64_t hits = 0;
+                double heat = 0;
+            };
+            // Oldest first, which breaks ties
+            std::vector<entry> entries_;
+            std::array<std::optional<slot>, slot_count> slots_ = {};
+    };
+}
+
+#endif
@@ -2,21 +2,26 @@
 #define SDB_DISASSEMBLER_HPP
 
 #include <libsdb/process.hpp>
+#include <libsdb/instruction_cache.hpp>
 #include <optional>
 
 namespace sdb {
     class disassembler {
-        struct instruction {
-            virt_addr address;
-            std::string text;
-        };
-
         public:
             disassembler(process& proc) : process_(&proc) {}
 
+            // Decodes are served from and recorded in the process's
+            // instruction cache
             std::vector<instruction> disassemble(
                 std::size_t n_instructions,
                 std::optional<virt_addr> address = std::nullopt);
+            // Linear sweep of [low, high). Bytes which don't decode and runs
+            // of zero padding are skipped, so the result can have gaps
+            std::vector<instruction> disassemble_range(
+                virt_addr low, virt_addr high);
+            // Decodes the instruction at address, or nullopt if it can't
+            // run from a copy, such as a syscall or an int3
+            std::optional<relocation_info> relocation(virt_addr address);
 
         private:
             process* process_;
@@ -0,0 +1,60 @@
+#ifndef SDB_EXPRESSION_HPP
+#define SDB_EXPRESSION_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+
+namespace sdb {
+    class process;
+    struct register_info;
+
+    // A C-like expression over general purpose registers, memory reads
+    // (mem8[addr] to mem64[addr], or [addr] for 64 bits) and integer
+    // literals, used for breakpoint conditions and tracepoint captures. It
+    // is compiled once into stack bytecode so that evaluating it on each
+    // hit costs no parsing. All arithmetic is unsigned 64-bit, and && and
+    // || short-circuit
+    class expression {
+        public:
+            explicit expression(std::string_view source);
+
+            const std::string& source() const { return source_; }
+
+            // Evaluated against the given thread; conditions hold when the
+            // result is nonzero
+            std::uint64_t evaluate(const process& proc, pid_t tid) const;
+
+        private:
+            enum class opcode : std::uint8_t {
+                constant, read_register, read_memory,
+                negate, bit_not, logical_not,
+                add, subtract, multiply, divide, modulo,
+                bit_and, bit_or, bit_xor, shift_left, shift_right,
+                equal, not_equal, less, less_equal, greater, greater_equal,
+                // Leave 0 and skip to operand if the top is zero, otherwise
+                // pop it; used for short-circuiting
+                and_jump,
+                // Leave 1 and skip to operand if the top is nonzero,
+                // otherwise pop it
+                or_jump,
+                to_bool
+            };
+
+            struct instruction {
+                opcode code;
+                // The constant, register, read size or jump target
+                std::uint64_t operand = 0;
+                const register_info* reg = nullptr;
+            };
+
+            friend class expression_compiler;
+
+            std::string source_;
+            std::vector<instruction> code_;
+    };
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SDB_INSTRUCTION_CACHE_HPP
+#define SDB_INSTRUCTION_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+
+#include <libsdb/types.hpp>
+
+namespace sdb {
+    enum class instruction_kind {
+        other, call, ret, jump, conditional_jump, syscall,
+        // Prologue instructions, which tell us where the return address is
+        // before the frame pointer has been set up
+        function_entry, frame_setup
+    };
+
+    struct instruction {
+        virt_addr address;
+        std::string text;
+        std::uint8_t length = 0;
+        instruction_kind kind = instruction_kind::other;
+        // Destination of a direct (relative) call or jump
+        std::optional<virt_addr> branch_target = std::nullopt;
+    };
+
+    // What changes when an instruction is copied elsewhere and run there
+    struct relocation_info {
+        std::uint8_t length = 0;
+        // Offset of the 32-bit displacement of a RIP-relative operand
+        std::optional<std::uint8_t> rip_displacement_offset;
+        // Whether rip afterwards is relative to where the instruction ran,
+        // which is true of everything but indirect branches and returns
+        bool relative_rip = true;
+        bool pushes_return_address = false;
+    };
+
+    // Decoded instructions keyed by address. Entries stay valid across
+    // resumes and are only dropped when the debugger writes to the bytes
+    // they were decoded from.
+    class instruction_cache {
+        public:
+            static constexpr std::size_t max_instruction_length = 15;
+
+            const instruction* find(virt_addr address) const;
+            const instruction& insert(instruction instr);
+
+            void invalidate(virt_addr address, std::size_t size);
+            void clear() { instructions_.clear(); }
+
+            std::size_t size() const { return instructions_.size(); }
+            std::size_t hits() const { return hits_; }
+            std::size_t misses() const { return misses_; }
+
+        private:
+            std::map<virt_addr, instruction> instructions_;
+            mutable std::size_t hits_ = 0;
+            mutable std::size_t misses_ = 0;
+    };
+}
+
+#endif
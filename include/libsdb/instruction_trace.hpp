@@ -0,0 +1,89 @@
+#ifndef SDB_INSTRUCTION_TRACE_HPP
+#define SDB_INSTRUCTION_TRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <sys/user.h>
+
+namespace sdb {
+    // Executed instructions written to a memory-mapped file. Each entry is
+    // the change in rip since the previous one as a zigzag varint, so
+    // straight-line code costs a byte per instruction. With registers
+    // enabled it is followed by a varint mask of the general purpose
+    // registers which changed and a zigzag varint delta for each of them
+    class instruction_trace {
+        public:
+            instruction_trace() = delete;
+            instruction_trace(const instruction_trace&) = delete;
+            instruction_trace& operator=(const instruction_trace&) = delete;
+
+            explicit instruction_trace(
+                const std::filesystem::path& path,
+                bool record_registers = false);
+            ~instruction_trace();
+
+            bool records_registers() const { return record_registers_; }
+            std::size_t size() const { return count_; }
+
+            void append(std::uint64_t rip);
+            void append(const user_regs_struct& regs);
+
+            // Writes the header and trims the file, so what was traced so
+            // far can be read; called on destruction. Appending afterwards
+            // grows the file again
+            void finish();
+
+        private:
+            void reserve(std::size_t bytes);
+
+            int fd_ = -1;
+            std::byte* data_ = nullptr;
+            // Of the mapping, which finish() can leave larger than the
+            // file
+            std::size_t capacity_ = 0;
+            std::size_t file_size_ = 0;
+            std::size_t offset_ = 0;
+            std::size_t count_ = 0;
+            bool record_registers_;
+            std::uint64_t last_rip_ = 0;
+            user_regs_struct last_regs_ = {};
+    };
+
+    struct instruction_trace_entry {
+        std::uint64_t rip;
+        // Only filled in when the trace has registers
+        user_regs_struct regs;
+    };
+
+    // Replays a trace written by instruction_trace
+    class instruction_trace_reader {
+        public:
+            instruction_trace_reader() = delete;
+            instruction_trace_reader(const instruction_trace_reader&) = delete;
+            instruction_trace_reader& operator=(
+                const instruction_trace_reader&) = delete;
+
+            explicit instruction_trace_reader(
+                const std::filesystem::path& path);
+            ~instruction_trace_reader();
+
+            bool has_registers() const { return has_registers_; }
+            std::size_t size() const { return count_; }
+
+            std::optional<instruction_trace_entry> next();
+
+        private:
+            const std::byte* data_ = nullptr;
+            std::size_t size_ = 0;
+            std::size_t end_ = 0;
+            std::size_t offset_ = 0;
+            std::size_t count_ = 0;
+            std::size_t read_ = 0;
+            bool has_registers_ = false;
+            instruction_trace_entry current_ = {};
+    };
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef SDB_LATENCY_TRACER_HPP
+#define SDB_LATENCY_TRACER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <libsdb/process.hpp>
+
+namespace sdb {
+    // Histogram in the style of HdrHistogram: each power of two range is
+    // split into 2^sub_bucket_bits linear buckets, so any value is kept to
+    // within about 3% whatever its magnitude, in a few kilobytes
+    class hdr_histogram {
+        public:
+            static constexpr unsigned sub_bucket_bits = 5;
+            static constexpr std::uint64_t sub_bucket_count =
+                std::uint64_t{ 1 } << sub_bucket_bits;
+
+            void add(std::uint64_t value);
+
+            std::uint64_t count() const { return count_; }
+            std::uint64_t min() const { return min_; }
+            std::uint64_t max() const { return max_; }
+            std::uint64_t mean() const {
+                return count_ == 0 ? 0 : total_ / count_;
+            }
+            // The value below which the given fraction of those recorded
+            // fall, e.g. 0.99 for the 99th percentile, rounded up to the
+            // top of its bucket
+            std::uint64_t percentile(double fraction) const;
+
+            struct bucket {
+                // Both inclusive
+                std::uint64_t low;
+                std::uint64_t high;
+                std::uint64_t count;
+            };
+            // Buckets which hold any values, lowest first
+            std::vector<bucket> buckets() const;
+
+        private:
+            static std::size_t index_of(std::uint64_t value);
+            static bucket bounds_of(std::size_t index);
+
+            std::vector<std::uint64_t> counts_;
+            std::uint64_t count_ = 0;
+            std::uint64_t total_ = 0;
+            std::uint64_t min_ = 0;
+            std::uint64_t max_ = 0;
+    };
+
+    // Times calls to functions without ever reporting a stop. Each function
+    // entry gets an internal breakpoint, and each hit plants another on the
+    // return address at [rsp], which is removed once no call is waiting on
+    // it. Both kinds of stop are handled as they arrive and the process
+    // resumed, so latencies include the time the debugger takes to see
+    // them
+    class latency_tracer {
+        public:
+            latency_tracer() = delete;
+            latency_tracer(const latency_tracer&) = delete;
+            latency_tracer& operator=(const latency_tracer&) = delete;
+
+            explicit latency_tracer(process& proc) : process_(&proc) {}
+
+            // Times calls to the function starting at the address
+            void trace(virt_addr entry);
+
+            // Resumes the process and times calls until it exits or
+            // stop_requested returns true. That is checked after every
+            // stop, so a caller ending the trace early should also stop the
+            // process, e.g. with SIGSTOP. Other signals are passed on
+            void run(std::function<bool()> stop_requested = {});
+
+            // Returns false if the stop wasn't for one of our breakpoints
+            bool record(const stop_reason& reason);
+
+            // Nanoseconds per call, by function entry and then thread
+            const std::map<virt_addr, std::map<pid_t, hdr_histogram>>&
+            latencies() const {
+                return latencies_;
+            }
+            // How the process ended, if it did while being traced
+            const std::optional<stop_reason>& exit_reason() const {
+                return exit_reason_;
+            }
+
+        private:
+            struct open_call {
+                virt_addr entry;
+                virt_addr return_address;
+                // rsp at the entry, which is 8 below rsp after the return
+                std::uint64_t frame_rsp;
+                std::uint64_t timestamp;
+            };
+
+            void plant_return(virt_addr address);
+            void release_return(virt_addr address);
+
+            process* process_;
+            std::unordered_set<std::uint64_t> entries_;
+            std::map<virt_addr, std::map<pid_t, hdr_histogram>> latencies_;
+            // Innermost last
+            std::unordered_map<pid_t, std::vector<open_call>> open_calls_;
+            struct return_site {
+                std::size_t waiting;
+                // Sites which were already there are left alone
+                bool owned;
+            };
+            std::unordered_map<std::uint64_t, return_site> return_sites_;
+            std::optional<stop_reason> exit_reason_;
+            std::chrono::steady_clock::time_point start_ =
+                std::chrono::steady_clock::now();
+    };
+}
+
+#endif
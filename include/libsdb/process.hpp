@@ -1,20 +1,30 @@
 #ifndef SDB_PROCESS_HPP
 #define SDB_PROCESS_HPP
 
+#include <chrono>
 #include <filesystem>
 #include <memory>
 #include <optional>
 #include <sys/types.h>
 #include <vector>
+#include <array>
+#include <unordered_map>
+#include <map>
+#include <utility>
 
 #include <libsdb/registers.hpp>
 #include <libsdb/types.hpp>
 #include <libsdb/breakpoint_site.hpp>
 #include <libsdb/watchpoint.hpp>
 #include <libsdb/stoppoint_collection.hpp>
+#include <libsdb/instruction_cache.hpp>
+#include <libsdb/debug_registers.hpp>
 #include <libsdb/bit.hpp>
 
 namespace sdb {
+    class session;
+    class instruction_trace;
+
     struct syscall_information {
         std::uint16_t id;
         bool entry;
@@ -26,7 +36,7 @@ namespace sdb {
 
     enum class trap_type {
         single_step, software_break,
-        hardware_break, syscall, unknown
+        hardware_break, software_watch, syscall, fork, exec, unknown
     };
 
     enum class process_state {
@@ -44,6 +54,39 @@ namespace sdb {
 
         std::optional<trap_type> trap_reason;
         std::optional<syscall_information> syscall_info;
+        // The thread which reported the stop
+        pid_t tid = 0;
+        // For fork stops, the new process and whether it is a vfork child
+        // running in the parent's memory
+        std::optional<pid_t> child_pid;
+        bool shares_memory = false;
+        // For software watchpoint stops, the watchpoint which triggered
+        std::optional<watchpoint::id_type> watchpoint_id;
+    };
+
+    // How a stop in one thread affects the others. In all-stop mode every
+    // thread is halted before a stop is reported and resume() restarts all
+    // of them; in non-stop mode only the reporting thread stops and resume()
+    // restarts just the current thread
+    enum class stop_mode {
+        all_stop, non_stop
+    };
+
+    struct thread_state {
+        pid_t tid;
+        process_state state = process_state::stopped;
+        std::unique_ptr<registers> regs;
+        // A stop which was collected while halting the thread for another
+        // thread's stop, and is reported on the next wait instead of
+        // resuming
+        std::optional<int> pending_status;
+        // We halted the thread with SIGSTOP or PTRACE_INTERRUPT and it
+        // hasn't reported that yet
+        bool pending_interrupt = false;
+        bool expecting_syscall_exit = false;
+        // Addresses in pages protected by software watchpoints which the
+        // thread faulted on while single stepping
+        std::vector<std::uint64_t> watch_faults;
     };
 
     class syscall_catch_policy {
@@ -86,24 +129,85 @@ namespace sdb {
             static std::unique_ptr<process> launch(
                     std::filesystem::path path, 
                     bool debug = true,
-                    std::optional<int> stdout_replacement = std::nullopt);
+                    std::optional<int> stdout_replacement = std::nullopt,
+                    syscall_catch_policy syscall_policy =
+                        syscall_catch_policy::catch_none());
             static std::unique_ptr<process> attach(pid_t pid);
-
-            void resume();
+            // Attaches with PTRACE_SEIZE, leaving the process running. It can
+            // then be stopped with interrupt() without sending it a signal
+            static std::unique_ptr<process> seize(pid_t pid);
+
+            // Restarts every thread in all-stop mode, or only the current
+            // one in non-stop mode. A signal is delivered to the current
+            // thread; by default the one it stopped with is discarded
+            void resume(int signal = 0);
+            void resume_all_threads(int signal = 0);
+            // Stops every running thread
+            void interrupt();
             stop_reason wait_on_signal();
+            // Non-blocking variants for callers multiplexing several
+            // inferiors; nullopt means no stop was reported yet
+            std::optional<stop_reason> try_wait();
+            std::optional<stop_reason> wait_for(
+                std::chrono::microseconds timeout);
+            // Becomes readable once the inferior exits, for use with
+            // poll/epoll alongside other descriptors
+            int pidfd();
             sdb::stop_reason step_instruction();
+            // Single steps the current thread up to count times, appending
+            // where each step lands to the trace. Breakpoints are lifted for
+            // the duration and none of step_instruction's per-step checks
+            // are made. Returns the reason for the last stop, which is a
+            // single step unless something ended the trace early
+            sdb::stop_reason trace_instructions(
+                std::size_t count, instruction_trace& trace);
+            // Run over a call, or out of the current function, with an
+            // internal breakpoint on the return address. Past the
+            // prologue step_out finds that through rbp, so it relies on
+            // frame pointers. If [rbp+8] isn't on the stack or doesn't
+            // follow a call, it steps over calls until a ret instead. A
+            // leaf function which never set up rbp has its caller's frame,
+            // so stepping out of one runs out of the caller too
+            sdb::stop_reason step_over();
+            sdb::stop_reason step_out();
 
             pid_t pid() const { return pid_; }
 
             process_state state() const { return state_; }
 
-            registers& get_registers() { return *registers_; }
-            const registers& get_registers() const { return *registers_; }
+            // Registers of the current thread, which is the one that last
+            // reported a stop unless changed with set_current_thread
+            registers& get_registers() {
+                return get_registers(current_thread_);
+            }
+            const registers& get_registers() const {
+                return get_registers(current_thread_);
+            }
+            registers& get_registers(pid_t tid) {
+                return *threads_.at(tid).regs;
+            }
+            const registers& get_registers(pid_t tid) const {
+                return *threads_.at(tid).regs;
+            }
+
+            const std::map<pid_t, thread_state>& threads() const {
+                return threads_;
+            }
+            pid_t current_thread() const { return current_thread_; }
+            void set_current_thread(pid_t tid);
 
-            void write_fprs(const user_fpregs_struct& fprs);
-            void write_gprs(const user_regs_struct& gprs);
+            stop_mode get_stop_mode() const { return stop_mode_; }
+            void set_stop_mode(stop_mode mode) { stop_mode_ = mode; }
 
-            void write_user_area(std::size_t offset, std::uint64_t data);
+            void read_fprs(user_fpregs_struct& fprs, pid_t tid) const;
+            void read_gprs(user_regs_struct& gprs, pid_t tid) const;
+            std::uint64_t read_user_area(std::size_t offset, pid_t tid) const;
+
+            void write_fprs(const user_fpregs_struct& fprs, pid_t tid);
+            void write_gprs(const user_regs_struct& gprs, pid_t tid);
+
+            void write_user_area(
+                std::size_t offset, std::uint64_t data, pid_t tid);
 
             virt_addr get_pc() const {
                 return virt_addr{
@@ -119,6 +223,14 @@ namespace sdb {
                 bool hardware = false,
                 bool internal = false);
 
+            // Creates many sites at once; enable_breakpoint_sites then
+            // patches each page of memory with one read and one write
+            std::vector<breakpoint_site*> create_breakpoint_sites(
+                span<const virt_addr> addresses,
+                bool internal = false);
+            void enable_breakpoint_sites(span<breakpoint_site* const> sites);
+            void enable_all_breakpoint_sites();
+
             stoppoint_collection<breakpoint_site>& breakpoint_sites() {
                 return breakpoint_sites_;
             }
@@ -135,62 +247,341 @@ namespace sdb {
                 return watchpoints_;
             }
 
+            instruction_cache& get_instruction_cache() {
+                return instruction_cache_;
+            }
+            const instruction_cache& get_instruction_cache() const {
+                return instruction_cache_;
+            }
+
             std::vector<std::byte> read_memory(
                 virt_addr address, std::size_t amount) const;
             std::vector<std::byte> read_memory_without_traps(
                 virt_addr address, std::size_t amount) const;
             void write_memory(virt_addr address, span<const std::byte> data);
 
+            // Reads are served from a page cache which lives until the
+            // process is resumed
+            std::size_t memory_cache_hits() const {
+                return memory_cache_hits_;
+            }
+            std::size_t memory_cache_misses() const {
+                return memory_cache_misses_;
+            }
+
             template <class T>
             T read_memory_as(virt_addr address) const {
                 auto data = read_memory(address, sizeof(T));
                 return from_bytes<T>(data.data());
             }
 
-            int set_hardware_breakpoint(
-                breakpoint_site::id_type, virt_addr address);
-
-            void clear_hardware_stoppoint(int index);
+            // Hardware stoppoints are shared out among the debug registers
+            // each time the process resumes. Those left without one are
+            // caught by taking protection away from their pages, as
+            // software watchpoints are, and execution away for execute
+            // stoppoints, which then stop as software ones
+            void set_hardware_breakpoint(
+                breakpoint_site::id_type id, virt_addr address);
+            void clear_hardware_stoppoint(hardware_stoppoint_id id);
+            const debug_register_allocator& hardware_stoppoints() const {
+                return hardware_stoppoints_;
+            }
 
-            int set_watchpoint(
+            // Returns whether the watchpoint is a hardware one, which it is
+            // if it fits a debug register
+            bool set_watchpoint(
                 watchpoint::id_type id, virt_addr address,
                 stoppoint_mode mode, std::size_t size);
+            void clear_software_watchpoint(
+                virt_addr address, stoppoint_mode mode, std::size_t size);
 
+            // The first of current_hardware_stoppoints()
             std::variant<breakpoint_site::id_type, watchpoint::id_type>
             get_current_hardware_stoppoint() const;
+            // Every stoppoint the last hardware stop was reported for
+            const std::vector<hardware_stoppoint_id>&
+            current_hardware_stoppoints() const {
+                return hardware_hits_;
+            }
 
-            void set_syscall_catch_policy(syscall_catch_policy info) {
-                syscall_catch_policy_ = std::move(info);
+            void set_syscall_catch_policy(syscall_catch_policy info);
+            // Whether a seccomp filter traps the policy's syscalls, so the
+            // others run without stopping. The filter is installed before
+            // exec, so only launches given the policy up front get one;
+            // attached processes stop at every syscall and those the
+            // policy doesn't catch are resumed by us
+            bool syscall_filter_active() const {
+                return syscall_filter_active_;
             }
 
+            // Hits of tracepoints since the last call, oldest first.
+            // Timestamps are nanoseconds on the steady clock
+            std::vector<tracepoint_hit> take_tracepoint_hits() {
+                return tracepoint_hits_.take();
+            }
+            // Hits overwritten since the last take_tracepoint_hits(), once
+            // more were waiting than the log holds
+            std::uint64_t dropped_tracepoint_hits() const {
+                return tracepoint_hits_.dropped();
+            }
+            // Drops any hits waiting
+            void set_tracepoint_log_capacity(std::size_t capacity) {
+                tracepoint_hits_ = tracepoint_log(capacity);
+            }
+
+            // Forks the stopped process into a copy which stays parked
+            // until restart() switches to it, and returns the copy's id.
+            // fork only copies the calling thread, so the process must have
+            // just the one. Restarting kills the process, so it must also be
+            // one we launched rather than attached to
+            int checkpoint();
+            // Kills the process and carries on in a fresh fork of the
+            // checkpoint, which stays parked to be restarted again.
+            // Breakpoints and watchpoints stay as they are now rather than
+            // as they were at the checkpoint
+            void restart(int id);
+            void delete_checkpoint(int id);
+
+            struct checkpoint_info {
+                int id;
+                pid_t pid;
+                virt_addr pc;
+            };
+            std::vector<checkpoint_info> checkpoints() const;
+
         private:
+            friend breakpoint_site;
+            friend session;
+
             process(pid_t pid, bool terminate_on_end, bool is_attached)
                 : pid_(pid), 
                     terminate_on_end_(terminate_on_end),
-                    is_attached_(is_attached), registers_(new registers(*this))
-            {}
-
-            void read_all_registers();
+                    is_attached_(is_attached), current_thread_(pid)
+            {
+                add_thread(pid);
+                register_for_waits();
+            }
 
             pid_t pid_ = 0;
             bool terminate_on_end_ = true;
             process_state state_ = process_state::stopped;
             bool is_attached_ = true;
-            std::unique_ptr<registers> registers_;
+
+            std::map<pid_t, thread_state> threads_;
+            pid_t current_thread_ = 0;
+            stop_mode stop_mode_ = stop_mode::all_stop;
+            // Shadow of dr0-dr7, which every thread shares so that hardware
+            // stoppoints trigger whichever thread touches them
+            std::array<std::uint64_t, 8> debug_registers_ = {};
+            debug_register_allocator hardware_stoppoints_;
+            // Hardware stoppoints without a register whose pages are
+            // protected for them
+            std::vector<hardware_stoppoint_request> backed_stoppoints_;
+            // Brings the debug registers and page protections up to date
+            // with the allocator, before any thread runs
+            void sync_debug_registers();
+            // An execute stoppoint without a register at the address
+            std::optional<hardware_stoppoint_id> backed_execute_stoppoint(
+                virt_addr address) const;
+            // Steps through instructions on a page whose execution was taken
+            // away until the thread leaves it or reaches a stoppoint
+            int step_through_page(thread_state& thread, std::uint64_t page);
+            // The stoppoints the current thread's last stop came from,
+            // updating the data of watchpoints in the registers it hit
+            std::vector<hardware_stoppoint_id> triggered_stoppoints();
+            std::vector<hardware_stoppoint_id> hardware_hits_;
+
+            thread_state& add_thread(pid_t tid);
+            void attach_threads();
+            bool owns_thread(pid_t tid) const;
+            // Next wait status for one of our threads, or nullopt if none is
+            // ready and block is false
+            std::optional<std::pair<pid_t, int>> next_wait_status(bool block);
+            void resume_thread(thread_state& thread, int signal = 0);
+            bool seized_ = false;
+            // Whether a wait status is the stop of an interrupt we sent
+            bool is_interrupt_stop(int wait_status) const;
+            // Returns the wait status of the step
+            int single_step_thread(thread_state& thread);
+            // Steps the thread past an enabled breakpoint at its pc and
+            // returns the wait status of the step, or nullopt if there is
+            // no breakpoint to step over
+            std::optional<int> step_over_breakpoint(thread_state& thread);
+
+            // Software breakpoints are stepped over by running a copy of
+            // the original instruction from a scratch page mapped in the
+            // inferior, so the int3 stays in place for other threads.
+            // Returns nullopt if the instruction has to run in place
+            std::optional<int> displaced_step(
+                thread_state& thread, virt_addr pc);
+            struct displaced_instruction {
+                virt_addr copy;
+                relocation_info info;
+            };
+            // nullopt entries are instructions which can't be displaced
+            std::unordered_map<std::uint64_t,
+                std::optional<displaced_instruction>> displaced_;
+            const displaced_instruction* displaced_copy(
+                thread_state& thread, virt_addr pc);
+            std::optional<virt_addr> allocate_scratch_slot(
+                thread_state& thread, virt_addr near);
+            virt_addr map_scratch_page(thread_state& thread, virt_addr near);
+            // Maps a page and returns its entry in scratch_pages_
+            std::pair<virt_addr, std::size_t>& add_scratch_page(
+                thread_state& thread, virt_addr near);
+            // Scratch pages and how many slots of each are used
+            std::vector<std::pair<virt_addr, std::size_t>> scratch_pages_;
+            // Runs a syscall in the stopped thread and returns its result,
+            // leaving the registers as they were
+            std::uint64_t inject_syscall(thread_state& thread, long number,
+                const std::array<std::uint64_t, 6>& args);
+            // A syscall instruction in the first scratch page
+            std::optional<virt_addr> syscall_instruction_;
+
+            // Pages whose protection software watchpoints took away. Write
+            // watchpoints make a page read-only and read/write ones make it
+            // inaccessible, for as long as any watchpoint covers it, and
+            // execute stoppoints without a register take away execution.
+            // The kernel's own accesses, as when read(2) fills a buffer,
+            // fail with EFAULT, so syscalls which fail that way are run
+            // again with the pages unprotected
+            struct protected_page {
+                int original = 0;
+                int applied = 0;
+                std::size_t writes = 0;
+                std::size_t accesses = 0;
+                std::size_t executes = 0;
+            };
+            std::map<std::uint64_t, protected_page> protected_pages_;
+            void set_software_watchpoint(
+                virt_addr address, stoppoint_mode mode, std::size_t size);
+            // Applies what the page's watchpoints need, forgetting the page
+            // once none is left
+            void update_page_protection(std::uint64_t page);
+            // Whether any page is protected for a data watchpoint, in which
+            // case every syscall exit is traced
+            bool protects_data() const;
+            // Runs a syscall which failed with EFAULT again with the
+            // protected pages lifted, returning the watchpoint to report if
+            // the kernel changed any
+            watchpoint* rerun_faulted_syscall(
+                thread_state& thread, syscall_information& info);
+            void protect_page(
+                thread_state& thread, std::uint64_t page, int protection);
+            int page_protection(std::uint64_t page) const;
+            // The faulting address if the stop is an access to a page
+            // protected for a software watchpoint
+            std::optional<std::uint64_t> software_watch_fault(
+                pid_t tid, int wait_status) const;
+            // The watchpoint the thread's recent faults triggered, if any,
+            // updating the data of those they touched
+            watchpoint* take_software_watch_hit(thread_state& thread);
+            // Whether a hit by the thread should be reported, counting it
+            // if it passes the condition. A condition which can't be
+            // evaluated counts as true
+            bool should_report_hit(breakpoint_site& site, pid_t tid);
+            bool should_report_hit(watchpoint& point, pid_t tid);
+            void record_tracepoint_hit(
+                const breakpoint_site& site, pid_t tid);
+            tracepoint_log tracepoint_hits_{
+                default_tracepoint_log_capacity };
+            // Halts every running thread but the one which just stopped
+            void stop_running_threads();
+            void write_debug_register(int index, std::uint64_t value);
+            // Leaves a process we detach from running its original code
+            void remove_stoppoints_for_detach();
+
+            // Fork and exec events are only traced on behalf of a session,
+            // which owns the resulting processes
+            void follow_forks();
+            bool follow_forks_ = false;
+            std::unique_ptr<process> adopt_fork_child(
+                const stop_reason& fork_stop, bool inherit_breakpoints);
+            void reset_after_exec();
+
+            // Stops we already hold for one of our threads
+            std::optional<std::pair<pid_t, int>> take_ready_status();
+            // For statuses of threads which belong to no process yet
+            static void park_wait_status(pid_t tid, int wait_status);
+            // Reaps the next status of any tracee, or nullopt if none is
+            // ready and block is false. Children of the debugger which no
+            // process object owns are left for whoever else waits for them
+            static std::optional<std::pair<pid_t, int>> reap_wait_status(
+                bool block);
+            static bool is_unclaimed_child(pid_t pid);
+            static std::optional<std::pair<pid_t, int>>
+            poll_registered_threads();
+            // Every live process is known to the others, so that statuses
+            // waitpid collects reach their owner. Statuses parked for our
+            // threads are dropped along with us
+            void register_for_waits();
+            void unregister_for_waits();
+            // Expects the lock on the registry to be held
+            void drop_parked_statuses() const;
+
+            // Parked copies, by id. The copies are processes of their own
+            // with no stoppoints, so restart only has to take over one
+            std::vector<std::pair<int, std::unique_ptr<process>>> checkpoints_;
+            int next_checkpoint_id_ = 1;
+            std::unique_ptr<process> fork_parked_copy();
+            // Kills a parked copy before it could run on being detached
+            static void discard_parked_copy(process& copy);
 
             void augment_stop_reason(stop_reason& reason);
+            // Returns nullopt when the stop was swallowed and the thread
+            // resumed again
+            std::optional<stop_reason> handle_wait_status(
+                pid_t tid, int wait_status);
+
+            int memory_fd() const;
+            bool write_memory_through_file(
+                virt_addr address, span<const std::byte> data);
+            // Unlike process_vm_readv, reads through /proc/<pid>/mem ignore
+            // page protections such as those of software watchpoints
+            bool read_memory_through_file(
+                virt_addr address, std::byte* data, std::size_t amount) const;
+            void write_memory_with_ptrace(
+                virt_addr address, span<const std::byte> data);
+            // Writes which don't change the trap-free view of memory, so
+            // decoded instructions stay valid
+            void patch_memory(virt_addr address, span<const std::byte> data);
+            mutable int memory_fd_ = -1;
+            int pidfd_ = -1;
+
+            using memory_page = std::array<std::byte, 0x1000>;
+            std::vector<std::byte> read_memory_uncached(
+                virt_addr address, std::size_t amount) const;
+            void cache_pages(const std::vector<std::uint64_t>& pages) const;
+            void update_memory_cache(
+                virt_addr address, span<const std::byte> data);
+            mutable std::unordered_map<std::uint64_t, memory_page>
+                memory_cache_;
+            mutable std::size_t memory_cache_hits_ = 0;
+            mutable std::size_t memory_cache_misses_ = 0;
+
+            instruction_cache instruction_cache_;
 
             stoppoint_collection<breakpoint_site> breakpoint_sites_;
             stoppoint_collection<watchpoint> watchpoints_;
 
-            int set_hardware_stoppoint(
-                virt_addr address, stoppoint_mode mode, std::size_t size);
-
             syscall_catch_policy syscall_catch_policy_ =
                 syscall_catch_policy::catch_none();
-            bool expecting_syscall_exit_ = false;
-            sdb::stop_reason maybe_resume_from_syscall(
+            // Syscalls trapped in-kernel by the seccomp filter installed at
+            // launch, sorted
+            std::vector<int> syscall_filter_;
+            bool syscall_filter_active_ = false;
+            std::optional<sdb::stop_reason> maybe_resume_from_syscall(
                 const stop_reason& reason);
+
+            sdb::stop_reason run_until_return(
+                virt_addr return_address, std::uint64_t frame_rsp);
+            // What the slot holds, if the slot is on the stack above rsp and
+            // that follows a call
+            std::optional<virt_addr> checked_return_address(
+                virt_addr slot, std::uint64_t rsp);
+            // The [low, high) range of the mapping holding the address
+            std::optional<std::pair<std::uint64_t, std::uint64_t>>
+            mapping_containing(std::uint64_t address) const;
     };
 }
 
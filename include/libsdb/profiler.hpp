@@ -0,0 +1,67 @@
+#ifndef SDB_PROFILER_HPP
+#define SDB_PROFILER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <libsdb/process.hpp>
+
+namespace sdb {
+    // Samples the stacks of every thread in a running process by stopping
+    // it at a fixed rate and walking frame pointers
+    class profiler {
+        public:
+            profiler() = delete;
+            profiler(const profiler&) = delete;
+            profiler& operator=(const profiler&) = delete;
+
+            explicit profiler(process& proc, std::size_t max_depth = 128)
+                : process_(&proc), max_depth_(max_depth) {}
+
+            // Samples until the process exits, the duration runs out or
+            // stop_requested returns true
+            void run(unsigned hz,
+                std::optional<std::chrono::nanoseconds> duration = std::nullopt,
+                std::function<bool()> stop_requested = {});
+
+            // Stops the process, records one stack per thread and resumes
+            // it. Returns false once the process has ended
+            bool sample();
+
+            // Innermost frame first
+            using stack = std::vector<std::uint64_t>;
+
+            struct stack_hash {
+                std::size_t operator()(const stack& frames) const;
+            };
+
+            const std::unordered_map<stack, std::size_t, stack_hash>&
+            stacks() const {
+                return stacks_;
+            }
+            std::size_t sample_count() const { return samples_; }
+
+            // One line per distinct stack, outermost frame first, in the
+            // format flame graph tools expect
+            void write_folded(std::ostream& out) const;
+
+        private:
+            stack walk_stack(pid_t tid) const;
+            // Handles stops the process reported since the last sample,
+            // passing on the signals it received. Returns false once the
+            // process has ended
+            bool drain_stops();
+
+            process* process_;
+            std::size_t max_depth_;
+            std::unordered_map<stack, std::size_t, stack_hash> stacks_;
+            std::size_t samples_ = 0;
+    };
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define SDB_REGISTERS_HPP
 
 #include <sys/user.h>
+#include <sys/types.h>
 #include <libsdb/register_info.hpp>
 #include <variant>
 #include <libsdb/types.hpp>
@@ -30,12 +31,33 @@ namespace sdb {
             write(register_info_by_id(id), val);
         }
 
+        // Writes are cached and only pushed to the inferior by flush, which
+        // the process calls before it resumes
+        void flush();
+        std::size_t ptrace_calls_saved() const { return ptrace_calls_saved_; }
+
     private:
         friend process;
-        registers(process& proc) : proc_(&proc) {}
+        registers(process& proc, pid_t tid) : proc_(&proc), tid_(tid) {}
+
+        // Each register class is fetched from the inferior the first time
+        // one of its registers is accessed after a stop
+        void ensure_loaded(const register_info& info) const;
+        void invalidate();
 
-        user data_;
+        mutable user data_;
         process* proc_;
+        pid_t tid_;
+
+        mutable bool gprs_loaded_ = false;
+        mutable bool fprs_loaded_ = false;
+        mutable std::uint8_t loaded_debug_registers_ = 0;
+
+        bool gprs_dirty_ = false;
+        bool fprs_dirty_ = false;
+        std::uint8_t dirty_debug_registers_ = 0;
+        std::size_t pending_writes_ = 0;
+        std::size_t ptrace_calls_saved_ = 0;
     };
 }
 
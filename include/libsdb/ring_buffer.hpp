@@ -0,0 +1,72 @@
+#ifndef SDB_RING_BUFFER_HPP
+#define SDB_RING_BUFFER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <libsdb/error.hpp>
+
+namespace sdb {
+    // The most recent elements pushed, up to a fixed capacity, oldest
+    // first. Once it is full each push overwrites the oldest. Storage
+    // grows with the elements unless reserved up front
+    template <class T>
+    class ring_buffer {
+        public:
+            explicit ring_buffer(std::size_t capacity) : capacity_(capacity) {
+                if (capacity == 0) {
+                    error::send("Ring buffer capacity must be positive");
+                }
+            }
+
+            // Allocates the whole capacity now, for pushes on hot paths
+            void reserve() { elements_.reserve(capacity_); }
+
+            void push(T element) {
+                if (elements_.size() < capacity_) {
+                    elements_.push_back(std::move(element));
+                    return;
+                }
+                elements_[next_] = std::move(element);
+                next_ = (next_ + 1) % capacity_;
+                ++dropped_;
+            }
+
+            void clear() {
+                elements_.clear();
+                next_ = 0;
+                dropped_ = 0;
+            }
+
+            // Oldest first, emptying the buffer
+            std::vector<T> take() {
+                std::rotate(begin(elements_), begin(elements_) + next_,
+                    end(elements_));
+                next_ = 0;
+                dropped_ = 0;
+                return std::exchange(elements_, {});
+            }
+
+            std::size_t size() const { return elements_.size(); }
+            std::size_t capacity() const { return capacity_; }
+            // Elements overwritten since the last clear() or take()
+            std::uint64_t dropped() const { return dropped_; }
+
+            // Oldest first
+            const T& operator[](std::size_t index) const {
+                return elements_[(next_ + index) % elements_.size()];
+            }
+
+        private:
+            std::vector<T> elements_;
+            std::size_t capacity_;
+            // Where the next element goes once full, which is the oldest
+            std::size_t next_ = 0;
+            std::uint64_t dropped_ = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SDB_SESSION_HPP
+#define SDB_SESSION_HPP
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <unordered_set>
+#include <vector>
+#include <sys/types.h>
+
+#include <libsdb/process.hpp>
+
+namespace sdb {
+    // Owns a tree of processes, following them through fork and exec and
+    // dispatching every stop from a single waitpid loop
+    class session {
+        public:
+            session() = default;
+            session(const session&) = delete;
+            session& operator=(const session&) = delete;
+
+            struct event {
+                process* proc;
+                stop_reason reason;
+            };
+
+            process& launch(
+                std::filesystem::path path,
+                std::optional<int> stdout_replacement = std::nullopt);
+            process& attach(pid_t pid);
+
+            // Whether forked children stay under the debugger, and if so
+            // whether they keep the parent's breakpoints or run clean.
+            // vfork children share the parent's memory, so they always see
+            // its breakpoints until they exec
+            void set_follow_forks(bool follow) { follow_forks_ = follow; }
+            void set_inherit_breakpoints(bool inherit) {
+                inherit_breakpoints_ = inherit;
+            }
+            // Forks and execs are handled silently unless asked for. On a
+            // reported fork the followed child is left stopped too
+            void set_stop_on_fork(bool stop) { stop_on_fork_ = stop; }
+            void set_stop_on_exec(bool stop) { stop_on_exec_ = stop; }
+
+            event wait();
+            std::optional<event> try_wait();
+            void resume_all();
+
+            const std::vector<std::unique_ptr<process>>& processes() const {
+                return processes_;
+            }
+            process* find(pid_t pid) const;
+            // Detaches from or kills the process, as it was started
+            void remove(pid_t pid);
+
+        private:
+            process& add(std::unique_ptr<process> proc);
+            process* find_owner(pid_t tid) const;
+            std::optional<event> next_event(bool block);
+            std::optional<event> dispatch(process& proc, pid_t tid, int status);
+
+            std::vector<std::unique_ptr<process>> processes_;
+            // vfork children we don't follow, kept until they exec out of
+            // the parent's memory
+            std::unordered_set<pid_t> detach_after_exec_;
+
+            bool follow_forks_ = true;
+            bool inherit_breakpoints_ = true;
+            bool stop_on_fork_ = false;
+            bool stop_on_exec_ = false;
+    };
+}
+
+#endif
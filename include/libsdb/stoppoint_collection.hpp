@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <memory>
+#include <map>
+#include <unordered_map>
 #include <algorithm>
 
 #include <libsdb/types.hpp>
@@ -25,6 +27,18 @@ namespace sdb {
 
             void remove_by_id(typename Stoppoint::id_type id);
             void remove_by_address(virt_addr address);
+            // Drops every stoppoint without disabling it, for when the
+            // memory they patched is gone
+            void clear() {
+                stoppoints_.clear();
+                ids_.clear();
+                addresses_.clear();
+            }
+            // For bulk insertion
+            void reserve(std::size_t n) {
+                ids_.reserve(n);
+                addresses_.reserve(n);
+            }
 
             template <class F>
             void for_each(F f);
@@ -38,7 +52,15 @@ namespace sdb {
                 virt_addr low, virt_addr high) const;
 
         private:
-            using points_t = std::vector<std::unique_ptr<Stoppoint>>;
+            // Stoppoints are owned by an address-ordered map, with hash
+            // indexes on id and address so that lookups on every stop stay
+            // cheap with many thousands of stoppoints. Internal stoppoints
+            // share an id, hence the multimap
+            using points_t = std::map<virt_addr, std::unique_ptr<Stoppoint>>;
+            using id_index_t = std::unordered_multimap<
+                typename Stoppoint::id_type, Stoppoint*>;
+            using address_index_t = std::unordered_map<
+                std::uint64_t, typename points_t::iterator>;
 
             typename points_t::iterator find_by_id(typename Stoppoint::id_type id);
             typename points_t::const_iterator find_by_id(
@@ -47,22 +69,35 @@ namespace sdb {
             typename points_t::const_iterator find_by_address(
                 virt_addr address) const;
 
+            void erase(typename points_t::iterator it);
+
             points_t stoppoints_;
+            id_index_t ids_;
+            address_index_t addresses_;
     };
 
 
     template <class Stoppoint>
     Stoppoint& stoppoint_collection<Stoppoint>::push(
         std::unique_ptr<Stoppoint> bs) {
-        stoppoints_.push_back(std::move(bs));
-        return *stoppoints_.back();
+        auto& point = *bs;
+        // Indexed only once it is owned, so a duplicate leaves no trace
+        auto [it, inserted] =
+            stoppoints_.try_emplace(point.address(), std::move(bs));
+        if (!inserted) {
+            error::send("Stoppoint already exists at address");
+        }
+        ids_.emplace(point.id(), &point);
+        addresses_.emplace(point.address().addr(), it);
+        return point;
     }
 
     template <class Stoppoint>
     auto stoppoint_collection<Stoppoint>::find_by_id(
         typename Stoppoint::id_type id) -> typename points_t::iterator {
-        return std::find_if(begin(stoppoints_), end(stoppoints_), [=](auto&
-                    point) { return point->id() == id; });
+        auto it = ids_.find(id);
+        if (it == end(ids_)) return end(stoppoints_);
+        return stoppoints_.find(it->second->address());
     }
 
     template <class Stoppoint>
@@ -75,8 +110,9 @@ namespace sdb {
     template <class Stoppoint>
     auto stoppoint_collection<Stoppoint>::find_by_address(virt_addr address)
         -> typename points_t::iterator {
-        return std::find_if(begin(stoppoints_), end(stoppoints_),
-            [=](auto& point) { return point->at_address(address); });
+        auto it = addresses_.find(address.addr());
+        if (it == end(addresses_)) return end(stoppoints_);
+        return it->second;
     }
 
     template <class Stoppoint>
@@ -86,6 +122,18 @@ namespace sdb {
             const_cast<stoppoint_collection*>(this)->find_by_address(address);
     }
 
+    template <class Stoppoint>
+    void stoppoint_collection<Stoppoint>::erase(
+        typename points_t::iterator it) {
+        auto point = it->second.get();
+        auto [first, last] = ids_.equal_range(point->id());
+        auto id_it = std::find_if(first, last,
+            [=](auto& entry) { return entry.second == point; });
+        if (id_it != last) ids_.erase(id_it);
+        addresses_.erase(it->first.addr());
+        stoppoints_.erase(it);
+    }
+
     template <class Stoppoint>
     bool stoppoint_collection<Stoppoint>::contains_id(
         typename Stoppoint::id_type id) const {
@@ -101,8 +149,8 @@ namespace sdb {
     template <class Stoppoint>
     bool stoppoint_collection<Stoppoint>::enabled_stoppoint_at_address(
         virt_addr address) const {
-        return contains_address(address) and
-            get_by_address(address).is_enabled();
+        auto it = find_by_address(address);
+        return it != end(stoppoints_) and it->second->is_enabled();
     }
 
     template <class Stoppoint>
@@ -111,7 +159,7 @@ namespace sdb {
         auto it = find_by_id(id);
         if (it == end(stoppoints_))
             error::send("Invalid stoppoint id");
-        return **it;
+        return *it->second;
     }
 
     template <class Stoppoint>
@@ -126,7 +174,7 @@ namespace sdb {
         auto it = find_by_address(address);
         if (it == end(stoppoints_))
             error::send("Stoppoint with given address not found");
-        return **it;
+        return *it->second;
     }
 
     template <class Stoppoint>
@@ -140,21 +188,21 @@ namespace sdb {
     void stoppoint_collection<Stoppoint>::remove_by_id(
         typename Stoppoint::id_type id) {
         auto it = find_by_id(id);
-        (**it).disable();
-        stoppoints_.erase(it);
+        it->second->disable();
+        erase(it);
     }
 
     template <class Stoppoint>
     void stoppoint_collection<Stoppoint>::remove_by_address(virt_addr address) {
         auto it = find_by_address(address);
-        (**it).disable();
-        stoppoints_.erase(it);
+        it->second->disable();
+        erase(it);
     }
 
     template <class Stoppoint>
     template <class F>
     void stoppoint_collection<Stoppoint>::for_each(F f) {
-        for (auto& point : stoppoints_) {
+        for (auto& [address, point] : stoppoints_) {
             f(*point);
         }
     }
@@ -162,7 +210,7 @@ namespace sdb {
     template <class Stoppoint>
     template <class F>
     void stoppoint_collection<Stoppoint>::for_each(F f) const {
-        for (const auto& point : stoppoints_) {
+        for (const auto& [address, point] : stoppoints_) {
             f(*point);
         }
     }
@@ -172,10 +220,10 @@ namespace sdb {
         virt_addr low, virt_addr high) const 
     {
         std::vector<Stoppoint*> ret;
-        for (auto& site : stoppoints_) {
-            if (site->in_range(low, high)) {
-                ret.push_back(&*site);
-            }
+        auto first = stoppoints_.lower_bound(low);
+        auto last = stoppoints_.lower_bound(high);
+        for (auto it = first; it != last; ++it) {
+            ret.push_back(it->second.get());
         }
         return ret;
     }
@@ -0,0 +1,89 @@
+#ifndef SDB_SYSCALL_TRACER_HPP
+#define SDB_SYSCALL_TRACER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <libsdb/process.hpp>
+#include <libsdb/ring_buffer.hpp>
+
+namespace sdb {
+    // One syscall entry or exit, timestamped in nanoseconds since tracing
+    // began
+    struct syscall_record {
+        std::uint64_t timestamp;
+        pid_t tid;
+        syscall_information info;
+    };
+
+    // The most recent records, overwriting the oldest once it is full
+    using syscall_ring = ring_buffer<syscall_record>;
+
+    // Latencies bucketed by powers of two: bucket i counts latencies in
+    // [2^i, 2^(i+1)) nanoseconds, with 0 going in bucket 0
+    struct latency_histogram {
+        void add(std::uint64_t nanoseconds);
+
+        std::array<std::uint64_t, 64> buckets = {};
+        std::uint64_t count = 0;
+        std::uint64_t total = 0;
+        std::uint64_t min = std::numeric_limits<std::uint64_t>::max();
+        std::uint64_t max = 0;
+    };
+
+    // Records the syscalls selected by the process' catch policy without
+    // formatting them, so the cost per event is little more than the two
+    // ptrace stops. Latencies are measured between the entry and exit stops
+    // and so include the time the debugger takes to see them
+    class syscall_tracer {
+        public:
+            syscall_tracer() = delete;
+            syscall_tracer(const syscall_tracer&) = delete;
+            syscall_tracer& operator=(const syscall_tracer&) = delete;
+
+            explicit syscall_tracer(
+                process& proc, std::size_t capacity = 1 << 16);
+
+            // Resumes the process and records its syscalls until it exits
+            // or stop_requested returns true. That is checked after every
+            // stop, so a caller ending the trace early should also stop the
+            // process, e.g. with SIGSTOP. Other signals are passed on
+            void run(std::function<bool()> stop_requested = {});
+
+            // Returns false if the stop wasn't for a syscall
+            bool record(const stop_reason& reason);
+
+            const syscall_ring& records() const { return records_; }
+            const std::map<std::uint16_t, latency_histogram>&
+            latencies() const {
+                return latencies_;
+            }
+            // How the process ended, if it did while being traced
+            const std::optional<stop_reason>& exit_reason() const {
+                return exit_reason_;
+            }
+
+        private:
+            struct open_syscall {
+                std::uint16_t id;
+                std::uint64_t timestamp;
+            };
+
+            process* process_;
+            syscall_ring records_;
+            std::map<std::uint16_t, latency_histogram> latencies_;
+            std::unordered_map<pid_t, open_syscall> open_syscalls_;
+            std::optional<stop_reason> exit_reason_;
+            std::chrono::steady_clock::time_point start_ =
+                std::chrono::steady_clock::now();
+    };
+}
+
+#endif
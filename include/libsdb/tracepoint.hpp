@@ -0,0 +1,36 @@
+#ifndef SDB_TRACEPOINT_HPP
+#define SDB_TRACEPOINT_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include <libsdb/expression.hpp>
+#include <libsdb/ring_buffer.hpp>
+
+namespace sdb {
+    // Turns a breakpoint site into a tracepoint: each hit evaluates the
+    // captures and resumes straight away instead of stopping. The format
+    // is only kept for whoever prints the hits
+    struct trace_action {
+        std::string format;
+        std::vector<expression> captures;
+    };
+
+    struct tracepoint_hit {
+        std::int32_t id;
+        pid_t tid;
+        std::uint64_t timestamp;
+        // nullopt for captures which couldn't be evaluated
+        std::vector<std::optional<std::uint64_t>> values;
+    };
+
+    // Hits waiting to be printed. A hot tracepoint can fire many times
+    // before the next stop, so only the most recent are kept
+    using tracepoint_log = ring_buffer<tracepoint_hit>;
+    constexpr std::size_t default_tracepoint_log_capacity = 1 << 16;
+}
+
+#endif
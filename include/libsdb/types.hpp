@@ -63,7 +63,7 @@ namespace sdb {
                return addr_ != other.addr_;
            }
            bool operator<(const virt_addr& other) const {
-               return addr_ != other.addr_;
+               return addr_ < other.addr_;
            }
            bool operator<=(const virt_addr& other) const {
                return addr_ <= other.addr_;
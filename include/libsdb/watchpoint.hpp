@@ -3,12 +3,29 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <vector>
 
+#include <libsdb/ring_buffer.hpp>
 #include <libsdb/types.hpp>
 
 namespace sdb {
     class process;
 
+    // The watched value around one trigger. rip is where the thread was
+    // stopped, which for data watchpoints is just after the access, and
+    // timestamps are nanoseconds on the steady clock
+    struct watchpoint_hit {
+        std::uint64_t rip;
+        std::uint64_t timestamp;
+        std::uint64_t old_value;
+        std::uint64_t new_value;
+    };
+
+    // The most recent triggers of a watchpoint, oldest first. Once it is
+    // full each one overwrites the oldest
+    using watchpoint_history = ring_buffer<watchpoint_hit>;
+    constexpr std::size_t default_watchpoint_history_capacity = 4096;
+
     class watchpoint {
         public:
             watchpoint() = delete;
@@ -22,6 +39,11 @@ namespace sdb {
             void disable();
 
             bool is_enabled() const { return is_enabled_; }
+            // Watchpoints which don't fit a debug register, by size or
+            // alignment, are software ones. These take protection away from
+            // the pages they cover and catch the faults, as hardware ones
+            // do while others hold the registers
+            bool is_hardware() const { return is_hardware_; }
             virt_addr address() const { return address_; }
             stoppoint_mode mode() const { return mode_; }
             std::size_t size() const { return size_; }
@@ -33,11 +55,35 @@ namespace sdb {
                 return low <= address_ and high > address_;
             }
 
+            // Up to 8 bytes at data_address(), which for larger regions is
+            // where the last update found a change
             std::uint64_t data() const { return data_; }
             std::uint64_t previous_data() const { return previous_data_; }
+            virt_addr data_address() const { return address_ + data_offset_; }
+            // Whether the last update found any of the region changed
+            bool changed() const { return changed_; }
 
             void update_data();
 
+            // Triggers, including ignored ones
+            std::uint64_t hit_count() const { return hit_count_; }
+            void reset_hit_count() { hit_count_ = 0; }
+            // The next n triggers are counted but not reported
+            std::uint64_t ignore_count() const { return ignore_count_; }
+            void set_ignore_count(std::uint64_t n) { ignore_count_ = n; }
+
+            // Every trigger, ignored or not, is recorded here
+            const watchpoint_history& history() const { return history_; }
+            void clear_history() { history_.clear(); }
+            // Drops the current history
+            void set_history_capacity(std::size_t capacity) {
+                history_ = watchpoint_history(capacity);
+            }
+            // Triggers are recorded and the process resumed without
+            // stopping
+            bool auto_continues() const { return auto_continue_; }
+            void set_auto_continue(bool on) { auto_continue_ = on; }
+
         private:
             friend process;
             watchpoint(
@@ -50,10 +96,19 @@ namespace sdb {
             stoppoint_mode mode_;
             std::size_t size_;
             bool is_enabled_;
-            int hardware_register_index_ = -1;
+            bool is_hardware_ = false;
 
             std::uint64_t data_ = 0;
             std::uint64_t previous_data_ = 0;
+            std::size_t data_offset_ = 0;
+            bool changed_ = false;
+            std::vector<std::byte> contents_;
+
+            std::uint64_t hit_count_ = 0;
+            std::uint64_t ignore_count_ = 0;
+            watchpoint_history history_{
+                default_watchpoint_history_capacity };
+            bool auto_continue_ = false;
     };
 }
 
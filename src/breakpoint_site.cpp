@@ -1,5 +1,3 @@
-#include <sys/ptrace.h>
-
 #include <libsdb/breakpoint_site.hpp>
 #include <libsdb/process.hpp>
 #include <libsdb/error.hpp>
@@ -22,25 +20,13 @@ void sdb::breakpoint_site::enable() {
     if (is_enabled_) return;
 
     if (is_hardware_) {
-        hardware_register_index_ = 
-            process_->set_hardware_breakpoint(id_, address_);
+        process_->set_hardware_breakpoint(id_, address_);
     }
     else {
-        errno = 0;
-        std::uint64_t data = ptrace(
-            PTRACE_PEEKDATA, process_->pid(), address_, nullptr);
-        if (errno != 0) {
-            error::send_errno("Enabling breakpoint site failed");
-        }
-
-        saved_data_ = static_cast<std::byte>(data & 0xff);
-
-        std::uint64_t int3 = 0xcc;
-        std::uint64_t data_with_int3 = ((data & ~0xff) | int3);
+        saved_data_ = process_->read_memory(address_, 1)[0];
 
-        if (ptrace(PTRACE_POKEDATA, process_->pid(), address_, data_with_int3) < 0) {
-            error::send_errno("Enabling breakpoint site failed");
-        }
+        std::byte int3{ 0xcc };
+        process_->patch_memory(address_, { &int3, 1 });
     }
 
     is_enabled_ = true;
@@ -50,22 +36,11 @@ void sdb::breakpoint_site::disable() {
     if (!is_enabled_) return;
 
     if (is_hardware_) {
-        process_->clear_hardware_stoppoint(hardware_register_index_);
-        hardware_register_index_ = -1;
+        process_->clear_hardware_stoppoint(
+            hardware_stoppoint_id{ std::in_place_index<0>, id_ });
     }
-    else{
-        errno = 0;
-        std::uint64_t data = ptrace(
-            PTRACE_PEEKDATA, process_->pid(), address_, nullptr);
-        if (errno != 0) {
-            error::send_errno("Disabling breakpoint site failed");
-        }
-
-        auto restored_data = 
-            ((data & ~0xff) | static_cast<std::uint8_t>(saved_data_));
-        if (ptrace(PTRACE_POKEDATA, process_->pid(), address_, restored_data) < 0) {
-            error::send_errno("Disabling breakpoint site failed");
-        }
+    else {
+        process_->patch_memory(address_, { &saved_data_, 1 });
     }
 
     is_enabled_ = false;
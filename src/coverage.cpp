@@ -0,0 +1,181 @@
+#include <libsdb/coverage.hpp>
+#include <libsdb/disassembler.hpp>
+#include <libsdb/error.hpp>
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    bool ends_block(sdb::instruction_kind kind) {
+        using sdb::instruction_kind;
+        switch (kind) {
+            case instruction_kind::call:
+            case instruction_kind::ret:
+            case instruction_kind::jump:
+            case instruction_kind::conditional_jump:
+            case instruction_kind::syscall:
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+std::vector<sdb::virt_addr> sdb::coverage::find_basic_blocks(
+    process& proc, virt_addr low, virt_addr high)
+{
+    disassembler disas(proc);
+    auto instructions = disas.disassemble_range(low, high);
+
+    std::vector<virt_addr> starts;
+    std::vector<virt_addr> targets;
+    auto expected = low;
+    bool starts_block = true;
+    for (auto& instr : instructions) {
+        // Skipped bytes break the block too
+        if (starts_block or instr.address != expected) {
+            starts.push_back(instr.address);
+        }
+        starts_block = ends_block(instr.kind);
+        expected = instr.address + instr.length;
+
+        if (instr.branch_target and low <= *instr.branch_target and
+            *instr.branch_target < high) {
+            targets.push_back(*instr.branch_target);
+        }
+    }
+
+    // Only targets which land on an instruction we decoded are safe to
+    // patch
+    for (auto target : targets) {
+        auto it = std::lower_bound(begin(instructions), end(instructions),
+            target, [](auto& instr, auto addr) {
+                return instr.address < addr;
+            });
+        if (it != end(instructions) and it->address == target) {
+            starts.push_back(target);
+        }
+    }
+
+    std::sort(begin(starts), end(starts));
+    starts.erase(std::unique(begin(starts), end(starts)), end(starts));
+    return starts;
+}
+
+void sdb::coverage::instrument(std::optional<std::filesystem::path> file) {
+    auto proc_dir = "/proc/" + std::to_string(process_->pid());
+    if (!file) {
+        file = std::filesystem::read_symlink(proc_dir + "/exe");
+    }
+
+    std::ifstream maps(proc_dir + "/maps");
+    std::string line;
+    bool found = false;
+    while (std::getline(maps, line)) {
+        std::istringstream fields(line);
+        std::string range, perms, offset, device, inode, path;
+        fields >> range >> perms >> offset >> device >> inode;
+        std::getline(fields >> std::ws, path);
+        if (perms.size() < 3 or perms[2] != 'x' or path != file->string()) {
+            continue;
+        }
+
+        auto dash = range.find('-');
+        auto low = std::stoull(range.substr(0, dash), nullptr, 16);
+        auto high = std::stoull(range.substr(dash + 1), nullptr, 16);
+        instrument(virt_addr{ low }, virt_addr{ high });
+        found = true;
+    }
+    if (!found) {
+        error::send("No executable mappings for " + file->string());
+    }
+}
+
+void sdb::coverage::instrument(virt_addr low, virt_addr high) {
+    auto& sites = process_->breakpoint_sites();
+    std::vector<virt_addr> to_plant;
+    for (auto address : find_basic_blocks(*process_, low, high)) {
+        if (!sites.contains_address(address)) {
+            to_plant.push_back(address);
+        }
+    }
+
+    auto planted = process_->create_breakpoint_sites(
+        { to_plant.data(), to_plant.size() }, /*internal=*/true);
+    process_->enable_breakpoint_sites({ planted.data(), planted.size() });
+
+    std::vector<virt_addr> merged;
+    std::merge(begin(blocks_), end(blocks_),
+        begin(to_plant), end(to_plant), std::back_inserter(merged));
+    merged.erase(std::unique(begin(merged), end(merged)), end(merged));
+
+    // Regions may be instrumented in any order, so rebuild the bitmap
+    std::vector<std::uint8_t> bitmap((merged.size() + 7) / 8);
+    for (std::size_t i = 0; i < blocks_.size(); ++i) {
+        if (!is_covered(i)) continue;
+        auto index = std::lower_bound(begin(merged), end(merged), blocks_[i])
+            - begin(merged);
+        bitmap[index / 8] |= 1 << (index % 8);
+    }
+    blocks_ = std::move(merged);
+    bitmap_ = std::move(bitmap);
+}
+
+std::optional<std::size_t> sdb::coverage::index_of(virt_addr address) const {
+    auto it = std::lower_bound(begin(blocks_), end(blocks_), address);
+    if (it == end(blocks_) or *it != address) return std::nullopt;
+    return it - begin(blocks_);
+}
+
+sdb::stop_reason sdb::coverage::run() {
+    if (process_->state() == process_state::stopped) {
+        process_->resume();
+    }
+
+    while (true) {
+        auto reason = process_->wait_on_signal();
+        if (reason.reason == process_state::exited or
+            reason.reason == process_state::terminated) {
+            return reason;
+        }
+
+        if (record(reason) or reason.info == SIGTRAP) {
+            process_->resume();
+        }
+        else {
+            process_->resume(reason.info);
+        }
+    }
+}
+
+bool sdb::coverage::record(const stop_reason& reason) {
+    if (reason.reason != process_state::stopped or
+        reason.trap_reason != trap_type::software_break) {
+        return false;
+    }
+
+    auto pc = process_->get_pc();
+    auto& sites = process_->breakpoint_sites();
+    if (sites.contains_address(pc)) {
+        auto index = index_of(pc);
+        if (!index or !sites.get_by_address(pc).is_internal()) return false;
+
+        bitmap_[*index / 8] |= 1 << (*index % 8);
+        ++covered_;
+        sites.remove_by_address(pc);
+        return true;
+    }
+
+    // Another thread hit the block before its breakpoint was removed, so
+    // the pc wasn't rewound for it
+    if (auto index = index_of(pc - 1); index and is_covered(*index)) {
+        process_->set_pc(pc - 1);
+        return true;
+    }
+    return false;
+}
+
+void sdb::coverage::write_bitmap(std::ostream& out) const {
+    out.write(reinterpret_cast<const char*>(bitmap_.data()), bitmap_.size());
+}
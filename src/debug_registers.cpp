@@ -0,0 +1,157 @@
+#include <libsdb/debug_registers.hpp>
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+    bool fits_register(std::uint64_t address, std::size_t size) {
+        return (size == 1 or size == 2 or size == 4 or size == 8) and
+            (address & (size - 1)) == 0;
+    }
+
+    bool same_range(const sdb::debug_register_allocator::slot& lhs,
+        const sdb::debug_register_allocator::slot& rhs) {
+        return lhs.address == rhs.address and lhs.mode == rhs.mode and
+            lhs.size == rhs.size;
+    }
+}
+
+void sdb::debug_register_allocator::add(hardware_stoppoint_request request) {
+    entries_.push_back({ request });
+}
+
+void sdb::debug_register_allocator::remove(hardware_stoppoint_id owner) {
+    entries_.erase(std::remove_if(begin(entries_), end(entries_),
+        [&](auto& entry) { return entry.request.owner == owner; }),
+        end(entries_));
+}
+
+void sdb::debug_register_allocator::record_hit(hardware_stoppoint_id owner) {
+    for (auto& entry : entries_) {
+        if (entry.request.owner == owner) ++entry.hits;
+    }
+}
+
+bool sdb::debug_register_allocator::assign() {
+    for (auto& entry : entries_) {
+        entry.heat = entry.heat * 15 / 16 + entry.hits;
+        entry.hits = 0;
+    }
+
+    struct candidate {
+        slot range;
+        double heat;
+        std::size_t oldest;
+    };
+    std::vector<candidate> candidates;
+
+    // In address order each request can only pack into the range before it
+    std::vector<std::size_t> order(entries_.size());
+    std::iota(begin(order), end(order), 0);
+    std::sort(begin(order), end(order), [&](auto lhs, auto rhs) {
+        auto& l = entries_[lhs].request;
+        auto& r = entries_[rhs].request;
+        if (l.mode != r.mode) return l.mode < r.mode;
+        if (l.address != r.address) return l.address < r.address;
+        return l.size > r.size;
+    });
+    for (auto index : order) {
+        auto& [request, hits, heat] = entries_[index];
+        if (!candidates.empty()) {
+            auto& last = candidates.back();
+            auto low = last.range.address.addr();
+            auto high = std::max(
+                low + last.range.size, request.address.addr() + request.size);
+            // An execute breakpoint is only ever one byte. A hit on a
+            // register of writes is put down to whichever watchpoints'
+            // data changed, but nothing tells reads apart, so those only
+            // share when they watch the same bytes
+            auto packs = last.range.mode == request.mode and
+                request.address.addr() <= low + last.range.size;
+            if (request.mode == stoppoint_mode::write) {
+                packs = packs and fits_register(low, high - low);
+            }
+            else {
+                packs = packs and request.address.addr() == low and
+                    request.size == last.range.size;
+            }
+            if (packs) {
+                last.range.size = high - low;
+                last.range.owners.push_back(request.owner);
+                last.heat += heat;
+                last.oldest = std::min(last.oldest, index);
+                continue;
+            }
+        }
+        candidates.push_back({ { request.address, request.mode, request.size,
+            { request.owner } }, heat, index });
+    }
+
+    auto resident = [&](const candidate& c) {
+        return std::any_of(begin(slots_), end(slots_), [&](auto& current) {
+            return current and same_range(*current, c.range);
+        });
+    };
+    // Moving a stoppoint onto or off a register costs far more than a hit
+    // either way, so one only loses its register to another hit more than
+    // twice as often. Otherwise stoppoints hit in turn would take each
+    // other's registers every time
+    for (auto& c : candidates) {
+        if (resident(c)) c.heat *= 2;
+    }
+    std::sort(begin(candidates), end(candidates), [&](auto& lhs, auto& rhs) {
+        if (lhs.heat != rhs.heat) return lhs.heat > rhs.heat;
+        auto l = resident(lhs);
+        auto r = resident(rhs);
+        if (l != r) return l;
+        return lhs.oldest < rhs.oldest;
+    });
+    if (candidates.size() > slot_count) candidates.resize(slot_count);
+
+    std::array<std::optional<slot>, slot_count> slots = {};
+    std::vector<slot> moved;
+    for (auto& c : candidates) {
+        auto it = std::find_if(begin(slots_), end(slots_), [&](auto& current) {
+            return current and same_range(*current, c.range);
+        });
+        if (it != end(slots_)) {
+            slots[it - begin(slots_)] = std::move(c.range);
+        }
+        else {
+            moved.push_back(std::move(c.range));
+        }
+    }
+    for (auto& range : moved) {
+        auto free = std::find_if(begin(slots), end(slots),
+            [](auto& s) { return !s.has_value(); });
+        *free = std::move(range);
+    }
+
+    auto changed = false;
+    for (std::size_t i = 0; i < slot_count; ++i) {
+        if (slots[i].has_value() != slots_[i].has_value() or
+            (slots[i] and (!same_range(*slots[i], *slots_[i]) or
+                slots[i]->owners != slots_[i]->owners))) {
+            changed = true;
+        }
+    }
+    slots_ = std::move(slots);
+    return changed;
+}
+
+bool sdb::debug_register_allocator::is_resident(
+    hardware_stoppoint_id owner) const {
+    return std::any_of(begin(slots_), end(slots_), [&](auto& s) {
+        return s and std::find(begin(s->owners), end(s->owners), owner) !=
+            end(s->owners);
+    });
+}
+
+std::vector<sdb::hardware_stoppoint_request>
+sdb::debug_register_allocator::non_resident() const {
+    std::vector<hardware_stoppoint_request> ret;
+    for (auto& entry : entries_) {
+        if (!is_resident(entry.request.owner)) ret.push_back(entry.request);
+    }
+    return ret;
+}
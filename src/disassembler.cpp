@@ -1,7 +1,58 @@
 #include <Zydis/Zydis.h>
 #include <libsdb/disassembler.hpp>
 
-std::vector<sdb::disassembler::instruction> sdb::disassembler::disassemble(
+namespace {
+    sdb::instruction make_instruction(
+        sdb::virt_addr address, const ZydisDisassembledInstruction& instr)
+    {
+        using sdb::instruction_kind;
+
+        sdb::instruction ret{ address, std::string(instr.text),
+            instr.info.length };
+        switch (instr.info.meta.category) {
+            case ZYDIS_CATEGORY_CALL:
+                ret.kind = instruction_kind::call;
+                break;
+            case ZYDIS_CATEGORY_RET:
+                ret.kind = instruction_kind::ret;
+                break;
+            case ZYDIS_CATEGORY_UNCOND_BR:
+                ret.kind = instruction_kind::jump;
+                break;
+            case ZYDIS_CATEGORY_COND_BR:
+                ret.kind = instruction_kind::conditional_jump;
+                break;
+            case ZYDIS_CATEGORY_SYSCALL:
+                ret.kind = instruction_kind::syscall;
+                break;
+            default:
+                break;
+        }
+
+        auto is_register = [&](int index, ZydisRegister reg) {
+            return instr.operands[index].type == ZYDIS_OPERAND_TYPE_REGISTER
+                and instr.operands[index].reg.value == reg;
+        };
+        if (instr.info.mnemonic == ZYDIS_MNEMONIC_ENDBR64 or
+            (instr.info.mnemonic == ZYDIS_MNEMONIC_PUSH and
+                is_register(0, ZYDIS_REGISTER_RBP))) {
+            ret.kind = instruction_kind::function_entry;
+        }
+        else if (instr.info.mnemonic == ZYDIS_MNEMONIC_MOV and
+            is_register(0, ZYDIS_REGISTER_RBP) and
+            is_register(1, ZYDIS_REGISTER_RSP)) {
+            ret.kind = instruction_kind::frame_setup;
+        }
+
+        auto& imm = instr.info.raw.imm[0];
+        if (ret.kind != instruction_kind::other and imm.is_relative) {
+            ret.branch_target = address + instr.info.length + imm.value.s;
+        }
+        return ret;
+    }
+}
+
+std::vector<sdb::instruction> sdb::disassembler::disassemble(
     std::size_t n_instructions,
     std::optional<virt_addr> address) 
 {
@@ -11,22 +62,113 @@ std::vector<sdb::disassembler::instruction> sdb::disassembler::disassemble(
     if (!address) {
         address.emplace(process_->get_pc());
     }
-    auto code = process_->read_memory_without_traps(
-        *address, n_instructions * 15);
+
+    auto& cache = process_->get_instruction_cache();
+    while (ret.size() < n_instructions) {
+        auto cached = cache.find(*address);
+        if (!cached) break;
+        ret.push_back(*cached);
+        *address += cached->length;
+    }
+    if (ret.size() == n_instructions) return ret;
+
+    auto code = process_->read_memory_without_traps(*address,
+        (n_instructions - ret.size()) *
+            instruction_cache::max_instruction_length);
 
     ZyanUSize offset = 0;
     ZydisDisassembledInstruction instr;
 
-    while (ZYAN_SUCCESS(ZydisDisassembleATT(
+    while (ret.size() < n_instructions and ZYAN_SUCCESS(ZydisDisassembleATT(
         ZYDIS_MACHINE_MODE_LONG_64, address->addr(),
-        code.data() + offset, code.size() - offset, &instr)) 
-        and n_instructions > 0) 
+        code.data() + offset, code.size() - offset, &instr))) 
     {
-        ret.push_back(instruction{ *address, std::string(instr.text) });
+        ret.push_back(cache.insert(make_instruction(*address, instr)));
         offset += instr.info.length;
         *address += instr.info.length;
-        --n_instructions;
     }
 
     return ret;
 }
+
+std::vector<sdb::instruction> sdb::disassembler::disassemble_range(
+    virt_addr low, virt_addr high)
+{
+    std::vector<instruction> ret;
+    if (high <= low) return ret;
+
+    auto code = process_->read_memory_without_traps(
+        low, high.addr() - low.addr());
+    auto& cache = process_->get_instruction_cache();
+
+    ZyanUSize offset = 0;
+    ZydisDisassembledInstruction instr;
+    while (offset < code.size()) {
+        // add %al,(%rax) is never emitted on purpose, so zeros here are
+        // padding between sections and decoding them would lose sync with
+        // the code after
+        if (code[offset] == std::byte{ 0 } and offset + 1 < code.size() and
+            code[offset + 1] == std::byte{ 0 }) {
+            while (offset < code.size() and code[offset] == std::byte{ 0 }) {
+                ++offset;
+            }
+            continue;
+        }
+
+        auto address = low + offset;
+        if (auto cached = cache.find(address);
+            cached and offset + cached->length <= code.size()) {
+            ret.push_back(*cached);
+            offset += cached->length;
+        }
+        else if (ZYAN_SUCCESS(ZydisDisassembleATT(
+            ZYDIS_MACHINE_MODE_LONG_64, address.addr(),
+            code.data() + offset, code.size() - offset, &instr))) {
+            ret.push_back(cache.insert(make_instruction(address, instr)));
+            offset += instr.info.length;
+        }
+        else {
+            ++offset;
+        }
+    }
+    return ret;
+}
+
+std::optional<sdb::relocation_info> sdb::disassembler::relocation(
+    virt_addr address)
+{
+    auto code = process_->read_memory_without_traps(
+        address, instruction_cache::max_instruction_length);
+
+    ZydisDisassembledInstruction instr;
+    if (!ZYAN_SUCCESS(ZydisDisassembleATT(ZYDIS_MACHINE_MODE_LONG_64,
+        address.addr(), code.data(), code.size(), &instr))) {
+        return std::nullopt;
+    }
+
+    // These stop in the kernel with rip or rcx pointing into the copy
+    auto category = instr.info.meta.category;
+    if (category == ZYDIS_CATEGORY_SYSCALL or
+        category == ZYDIS_CATEGORY_INTERRUPT) {
+        return std::nullopt;
+    }
+
+    relocation_info ret;
+    ret.length = instr.info.length;
+    for (auto i = 0; i < instr.info.operand_count; ++i) {
+        auto& operand = instr.operands[i];
+        if (operand.type == ZYDIS_OPERAND_TYPE_MEMORY and
+            operand.mem.base == ZYDIS_REGISTER_RIP) {
+            ret.rip_displacement_offset = instr.info.raw.disp.offset;
+        }
+    }
+
+    auto is_relative = instr.info.raw.imm[0].is_relative;
+    if ((category == ZYDIS_CATEGORY_CALL or
+         category == ZYDIS_CATEGORY_UNCOND_BR or
+         category == ZYDIS_CATEGORY_RET) and !is_relative) {
+        ret.relative_rip = false;
+    }
+    ret.pushes_return_address = category == ZYDIS_CATEGORY_CALL;
+    return ret;
+}
@@ -0,0 +1,372 @@
+#include <libsdb/expression.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/register_info.hpp>
+#include <libsdb/error.hpp>
+#include <libsdb/parse.hpp>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace sdb {
+    // Recursive descent over the source, emitting bytecode as it goes
+    class expression_compiler {
+        public:
+            using opcode = expression::opcode;
+            using instruction = expression::instruction;
+
+            static constexpr std::size_t max_stack_depth = 64;
+            // Unary operators, parentheses and memory reads recurse in the
+            // parser, so their nesting is bounded too
+            static constexpr std::size_t max_nesting = 64;
+
+            expression_compiler(std::string_view source,
+                std::vector<instruction>& code)
+                : source_(source), code_(&code) {}
+
+            void compile() {
+                parse_binary(0);
+                skip_space();
+                if (pos_ != source_.size()) {
+                    fail("unexpected '" + std::string(source_.substr(pos_)) +
+                        "'");
+                }
+            }
+
+        private:
+            struct binary_operator {
+                std::string_view token;
+                int precedence;
+                opcode code;
+            };
+
+            // Longer tokens first, so that << isn't taken for <
+            static constexpr std::array<binary_operator, 18> operators_{{
+                { "||", 1, opcode::or_jump },
+                { "&&", 2, opcode::and_jump },
+                { "==", 6, opcode::equal },
+                { "!=", 6, opcode::not_equal },
+                { "<=", 7, opcode::less_equal },
+                { ">=", 7, opcode::greater_equal },
+                { "<<", 8, opcode::shift_left },
+                { ">>", 8, opcode::shift_right },
+                { "|", 3, opcode::bit_or },
+                { "^", 4, opcode::bit_xor },
+                { "&", 5, opcode::bit_and },
+                { "<", 7, opcode::less },
+                { ">", 7, opcode::greater },
+                { "+", 9, opcode::add },
+                { "-", 9, opcode::subtract },
+                { "*", 10, opcode::multiply },
+                { "/", 10, opcode::divide },
+                { "%", 10, opcode::modulo },
+            }};
+
+            [[noreturn]] void fail(const std::string& what) {
+                error::send("Invalid expression: " + what);
+            }
+
+            void skip_space() {
+                while (pos_ < source_.size() and std::isspace(source_[pos_])) {
+                    ++pos_;
+                }
+            }
+
+            bool accept(std::string_view token) {
+                skip_space();
+                if (source_.substr(pos_, token.size()) != token) return false;
+                pos_ += token.size();
+                return true;
+            }
+
+            void expect(std::string_view token) {
+                if (!accept(token)) {
+                    fail("expected '" + std::string(token) + "'");
+                }
+            }
+
+            std::size_t emit(opcode code, std::uint64_t operand = 0,
+                const register_info* reg = nullptr) {
+                switch (code) {
+                    case opcode::constant:
+                    case opcode::read_register:
+                        if (++depth_ > max_stack_depth) fail("too complex");
+                        break;
+                    case opcode::read_memory:
+                    case opcode::negate:
+                    case opcode::bit_not:
+                    case opcode::logical_not:
+                    case opcode::to_bool:
+                        break;
+                    default:
+                        --depth_;
+                        break;
+                }
+                code_->push_back({ code, operand, reg });
+                return code_->size() - 1;
+            }
+
+            const binary_operator* peek_operator() {
+                skip_space();
+                for (auto& op : operators_) {
+                    if (source_.substr(pos_, op.token.size()) != op.token) {
+                        continue;
+                    }
+                    // & and | are not the start of && and ||
+                    auto next = pos_ + op.token.size();
+                    if (op.token.size() == 1 and next < source_.size() and
+                        source_[next] == op.token[0] and
+                        (op.token[0] == '&' or op.token[0] == '|')) {
+                        continue;
+                    }
+                    return &op;
+                }
+                return nullptr;
+            }
+
+            // Precedence climbing; every operator is left associative
+            void parse_binary(int min_precedence) {
+                parse_unary();
+                while (auto op = peek_operator()) {
+                    if (op->precedence < min_precedence) break;
+                    pos_ += op->token.size();
+
+                    if (op->code == opcode::and_jump or
+                        op->code == opcode::or_jump) {
+                        auto jump = emit(op->code);
+                        parse_binary(op->precedence + 1);
+                        emit(opcode::to_bool);
+                        (*code_)[jump].operand = code_->size();
+                    }
+                    else {
+                        parse_binary(op->precedence + 1);
+                        emit(op->code);
+                    }
+                }
+            }
+
+            void parse_unary() {
+                if (++nesting_ > max_nesting) fail("nested too deeply");
+                if (accept("-")) {
+                    parse_unary();
+                    emit(opcode::negate);
+                }
+                else if (accept("~")) {
+                    parse_unary();
+                    emit(opcode::bit_not);
+                }
+                else if (accept("!")) {
+                    parse_unary();
+                    emit(opcode::logical_not);
+                }
+                else {
+                    parse_primary();
+                }
+                --nesting_;
+            }
+
+            void parse_memory_read(std::uint64_t size) {
+                expect("[");
+                parse_binary(0);
+                expect("]");
+                emit(opcode::read_memory, size);
+            }
+
+            void parse_primary() {
+                skip_space();
+                if (accept("(")) {
+                    parse_binary(0);
+                    expect(")");
+                    return;
+                }
+                if (pos_ < source_.size() and source_[pos_] == '[') {
+                    parse_memory_read(8);
+                    return;
+                }
+
+                auto start = pos_;
+                while (pos_ < source_.size() and
+                    (std::isalnum(source_[pos_]) or source_[pos_] == '_')) {
+                    ++pos_;
+                }
+                auto word = source_.substr(start, pos_ - start);
+                if (word.empty()) {
+                    fail(pos_ == source_.size() ?
+                        "unexpected end" :
+                        "unexpected '" + std::string(1, source_[pos_]) + "'");
+                }
+
+                if (std::isdigit(word[0])) {
+                    auto hex = word.size() > 2 and word[0] == '0' and
+                        (word[1] == 'x' or word[1] == 'X');
+                    auto value = hex ?
+                        to_integral<std::uint64_t>(word.substr(2), 16) :
+                        to_integral<std::uint64_t>(word);
+                    if (!value) fail("bad number '" + std::string(word) + "'");
+                    emit(opcode::constant, *value);
+                    return;
+                }
+
+                constexpr std::pair<std::string_view, std::uint64_t>
+                    memory_reads[] = {
+                        { "mem8", 1 }, { "mem16", 2 },
+                        { "mem32", 4 }, { "mem64", 8 } };
+                for (auto [name, size] : memory_reads) {
+                    if (word == name) {
+                        parse_memory_read(size);
+                        return;
+                    }
+                }
+
+                auto it = std::find_if(
+                    std::begin(g_register_infos), std::end(g_register_infos),
+                    [&](auto& info) { return info.name == word; });
+                if (it == std::end(g_register_infos) or
+                    (it->type != register_type::gpr and
+                        it->type != register_type::sub_gpr)) {
+                    fail("unknown register '" + std::string(word) + "'");
+                }
+                emit(opcode::read_register, 0, &*it);
+            }
+
+            std::string_view source_;
+            std::vector<instruction>* code_;
+            std::size_t pos_ = 0;
+            std::size_t depth_ = 0;
+            std::size_t nesting_ = 0;
+    };
+}
+
+sdb::expression::expression(std::string_view source)
+    : source_(source) {
+    expression_compiler(source_, code_).compile();
+}
+
+std::uint64_t sdb::expression::evaluate(
+    const process& proc, pid_t tid) const {
+    std::array<std::uint64_t, expression_compiler::max_stack_depth> stack;
+    std::size_t top = 0;
+    auto& regs = proc.get_registers(tid);
+
+    auto binary = [&](auto f) {
+        --top;
+        stack[top - 1] = f(stack[top - 1], stack[top]);
+    };
+
+    for (std::size_t pc = 0; pc < code_.size(); ++pc) {
+        auto& instr = code_[pc];
+        switch (instr.code) {
+            case opcode::constant:
+                stack[top++] = instr.operand;
+                break;
+            case opcode::read_register:
+                stack[top++] = std::visit([](auto value) -> std::uint64_t {
+                    if constexpr (std::is_integral_v<decltype(value)>) {
+                        return static_cast<std::uint64_t>(value);
+                    }
+                    else {
+                        return 0;
+                    }
+                }, regs.read(*instr.reg));
+                break;
+            case opcode::read_memory: {
+                auto data = proc.read_memory(
+                    virt_addr{ stack[top - 1] }, instr.operand);
+                if (data.size() != instr.operand) {
+                    error::send("Could not read memory for expression");
+                }
+                std::uint64_t value = 0;
+                std::memcpy(&value, data.data(), data.size());
+                stack[top - 1] = value;
+                break;
+            }
+            case opcode::negate:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case opcode::bit_not:
+                stack[top - 1] = ~stack[top - 1];
+                break;
+            case opcode::logical_not:
+                stack[top - 1] = !stack[top - 1];
+                break;
+            case opcode::to_bool:
+                stack[top - 1] = stack[top - 1] != 0;
+                break;
+            case opcode::add:
+                binary([](auto a, auto b) { return a + b; });
+                break;
+            case opcode::subtract:
+                binary([](auto a, auto b) { return a - b; });
+                break;
+            case opcode::multiply:
+                binary([](auto a, auto b) { return a * b; });
+                break;
+            case opcode::divide:
+            case opcode::modulo:
+                if (stack[top - 1] == 0) {
+                    error::send("Division by zero in expression");
+                }
+                if (instr.code == opcode::divide) {
+                    binary([](auto a, auto b) { return a / b; });
+                }
+                else {
+                    binary([](auto a, auto b) { return a % b; });
+                }
+                break;
+            case opcode::bit_and:
+                binary([](auto a, auto b) { return a & b; });
+                break;
+            case opcode::bit_or:
+                binary([](auto a, auto b) { return a | b; });
+                break;
+            case opcode::bit_xor:
+                binary([](auto a, auto b) { return a ^ b; });
+                break;
+            case opcode::shift_left:
+                binary([](auto a, auto b) { return b < 64 ? a << b : 0; });
+                break;
+            case opcode::shift_right:
+                binary([](auto a, auto b) { return b < 64 ? a >> b : 0; });
+                break;
+            case opcode::equal:
+                binary([](auto a, auto b) -> std::uint64_t { return a == b; });
+                break;
+            case opcode::not_equal:
+                binary([](auto a, auto b) -> std::uint64_t { return a != b; });
+                break;
+            case opcode::less:
+                binary([](auto a, auto b) -> std::uint64_t { return a < b; });
+                break;
+            case opcode::less_equal:
+                binary([](auto a, auto b) -> std::uint64_t { return a <= b; });
+                break;
+            case opcode::greater:
+                binary([](auto a, auto b) -> std::uint64_t { return a > b; });
+                break;
+            case opcode::greater_equal:
+                binary([](auto a, auto b) -> std::uint64_t { return a >= b; });
+                break;
+            case opcode::and_jump:
+                if (stack[top - 1] == 0) {
+                    pc = instr.operand - 1;
+                }
+                else {
+                    --top;
+                }
+                break;
+            case opcode::or_jump:
+                if (stack[top - 1] != 0) {
+                    stack[top - 1] = 1;
+                    pc = instr.operand - 1;
+                }
+                else {
+                    --top;
+                }
+                break;
+        }
+    }
+    return stack[0];
+}
@@ -0,0 +1,36 @@
+#include <libsdb/instruction_cache.hpp>
+
+const sdb::instruction* sdb::instruction_cache::find(virt_addr address) const {
+    auto it = instructions_.find(address);
+    if (it == end(instructions_)) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    return &it->second;
+}
+
+const sdb::instruction& sdb::instruction_cache::insert(instruction instr) {
+    auto address = instr.address;
+    return instructions_.insert_or_assign(address, std::move(instr))
+        .first->second;
+}
+
+void sdb::instruction_cache::invalidate(virt_addr address, std::size_t size) {
+    // An instruction which starts before the written range can still
+    // extend into it
+    auto low = address.addr() > max_instruction_length - 1 ?
+        address - (max_instruction_length - 1) : virt_addr{ 0 };
+    auto first = instructions_.lower_bound(low);
+    auto last = instructions_.lower_bound(address + size);
+
+    while (first != last) {
+        auto& instr = first->second;
+        if (instr.address + instr.length > address) {
+            first = instructions_.erase(first);
+        }
+        else {
+            ++first;
+        }
+    }
+}
@@ -0,0 +1,237 @@
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/error.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+    struct trace_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t flags;
+        std::uint64_t count;
+        std::uint64_t size;
+    };
+
+    constexpr char trace_magic[8] = { 'S', 'D', 'B', 'T', 'R', 'A', 'C', 'E' };
+    constexpr std::uint32_t trace_version = 1;
+    constexpr std::uint32_t has_registers_flag = 1;
+
+    constexpr std::size_t n_gprs =
+        sizeof(user_regs_struct) / sizeof(std::uint64_t);
+    static_assert(n_gprs <= 32, "Register mask must fit in 32 bits");
+
+    // Worst case for one entry: the rip delta, the mask and every register
+    constexpr std::size_t max_entry_size = 10 + 5 + n_gprs * 10;
+
+    std::uint64_t zigzag(std::int64_t value) {
+        return (static_cast<std::uint64_t>(value) << 1) ^
+            static_cast<std::uint64_t>(value >> 63);
+    }
+
+    std::int64_t unzigzag(std::uint64_t value) {
+        return static_cast<std::int64_t>(value >> 1) ^
+            -static_cast<std::int64_t>(value & 1);
+    }
+
+    std::byte* write_varint(std::byte* out, std::uint64_t value) {
+        while (value >= 0x80) {
+            *out++ = static_cast<std::byte>(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<std::byte>(value);
+        return out;
+    }
+
+    std::uint64_t read_varint(
+        const std::byte* data, std::size_t size, std::size_t& offset) {
+        std::uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (offset >= size) {
+                sdb::error::send("Truncated instruction trace");
+            }
+            auto byte = std::to_integer<std::uint64_t>(data[offset++]);
+            value |= (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        sdb::error::send("Malformed instruction trace");
+    }
+
+    // rip is already stored as the entry's own delta, so it is left out
+    std::array<std::uint64_t, n_gprs> as_words(const user_regs_struct& regs) {
+        std::array<std::uint64_t, n_gprs> words;
+        std::memcpy(words.data(), &regs, sizeof(regs));
+        words[offsetof(user_regs_struct, rip) / sizeof(std::uint64_t)] = 0;
+        return words;
+    }
+}
+
+sdb::instruction_trace::instruction_trace(
+    const std::filesystem::path& path, bool record_registers)
+    : record_registers_(record_registers) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        error::send_errno("Could not open trace file");
+    }
+    offset_ = sizeof(trace_header);
+    reserve(1 << 20);
+}
+
+sdb::instruction_trace::~instruction_trace() {
+    try {
+        finish();
+    }
+    catch (...) {}
+    if (data_) munmap(data_, capacity_);
+    if (fd_ >= 0) close(fd_);
+}
+
+void sdb::instruction_trace::reserve(std::size_t bytes) {
+    if (offset_ + bytes <= file_size_) return;
+
+    // Writes past the end of the file fault even within the mapping
+    auto new_capacity = offset_ + bytes <= capacity_ ?
+        capacity_ : std::max(capacity_ * 2, offset_ + bytes);
+    if (ftruncate(fd_, new_capacity) < 0) {
+        error::send_errno("Could not grow trace file");
+    }
+    file_size_ = new_capacity;
+    if (new_capacity == capacity_) return;
+
+    auto mapped = data_ ?
+        mremap(data_, capacity_, new_capacity, MREMAP_MAYMOVE) :
+        mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd_, 0);
+    if (mapped == MAP_FAILED) {
+        error::send_errno("Could not map trace file");
+    }
+    data_ = static_cast<std::byte*>(mapped);
+    capacity_ = new_capacity;
+}
+
+void sdb::instruction_trace::append(std::uint64_t rip) {
+    reserve(max_entry_size);
+    auto out = data_ + offset_;
+    out = write_varint(out, zigzag(rip - last_rip_));
+    if (record_registers_) {
+        // No register values to go with it, so nothing changed
+        out = write_varint(out, 0);
+    }
+    offset_ = out - data_;
+    last_rip_ = rip;
+    ++count_;
+}
+
+void sdb::instruction_trace::append(const user_regs_struct& regs) {
+    if (!record_registers_) {
+        append(regs.rip);
+        return;
+    }
+
+    reserve(max_entry_size);
+    auto out = data_ + offset_;
+    out = write_varint(out, zigzag(regs.rip - last_rip_));
+
+    auto words = as_words(regs);
+    auto last_words = as_words(last_regs_);
+    std::uint32_t mask = 0;
+    for (std::size_t i = 0; i < n_gprs; ++i) {
+        if (words[i] != last_words[i]) mask |= 1u << i;
+    }
+    out = write_varint(out, mask);
+    for (std::size_t i = 0; i < n_gprs; ++i) {
+        if (mask & (1u << i)) {
+            out = write_varint(out, zigzag(words[i] - last_words[i]));
+        }
+    }
+
+    offset_ = out - data_;
+    last_rip_ = regs.rip;
+    last_regs_ = regs;
+    ++count_;
+}
+
+void sdb::instruction_trace::finish() {
+    if (!data_) return;
+
+    trace_header header;
+    std::copy(std::begin(trace_magic), std::end(trace_magic), header.magic);
+    header.version = trace_version;
+    header.flags = record_registers_ ? has_registers_flag : 0;
+    header.count = count_;
+    header.size = offset_;
+    std::memcpy(data_, &header, sizeof(header));
+
+    if (ftruncate(fd_, offset_) < 0) {
+        error::send_errno("Could not trim trace file");
+    }
+    file_size_ = offset_;
+}
+
+sdb::instruction_trace_reader::instruction_trace_reader(
+    const std::filesystem::path& path) {
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error::send_errno("Could not open trace file");
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        error::send_errno("Could not read trace file");
+    }
+    size_ = info.st_size;
+    if (size_ < sizeof(trace_header)) {
+        close(fd);
+        error::send("Not an instruction trace");
+    }
+
+    auto mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        error::send_errno("Could not map trace file");
+    }
+    data_ = static_cast<const std::byte*>(mapped);
+
+    trace_header header;
+    std::memcpy(&header, data_, sizeof(header));
+    if (!std::equal(std::begin(trace_magic), std::end(trace_magic),
+            header.magic) or header.version != trace_version or
+        header.size > size_ or header.size < sizeof(header)) {
+        munmap(const_cast<std::byte*>(data_), size_);
+        data_ = nullptr;
+        error::send("Not an instruction trace");
+    }
+    has_registers_ = header.flags & has_registers_flag;
+    count_ = header.count;
+    end_ = header.size;
+    offset_ = sizeof(header);
+}
+
+sdb::instruction_trace_reader::~instruction_trace_reader() {
+    if (data_) munmap(const_cast<std::byte*>(data_), size_);
+}
+
+std::optional<sdb::instruction_trace_entry>
+sdb::instruction_trace_reader::next() {
+    if (read_ == count_) return std::nullopt;
+
+    current_.rip += unzigzag(read_varint(data_, end_, offset_));
+    if (has_registers_) {
+        auto mask = read_varint(data_, end_, offset_);
+        auto words = as_words(current_.regs);
+        for (std::size_t i = 0; i < n_gprs; ++i) {
+            if (mask & (1u << i)) {
+                words[i] += unzigzag(read_varint(data_, end_, offset_));
+            }
+        }
+        std::memcpy(&current_.regs, words.data(), sizeof(current_.regs));
+        current_.regs.rip = current_.rip;
+    }
+    ++read_;
+    return current_;
+}
@@ -0,0 +1,156 @@
+#include <libsdb/latency_tracer.hpp>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+
+std::size_t sdb::hdr_histogram::index_of(std::uint64_t value) {
+    if (value < sub_bucket_count) return value;
+    // Each power of two from sub_bucket_count up gets sub_bucket_count
+    // buckets as wide as that power allows
+    unsigned magnitude = 63 - __builtin_clzll(value);
+    auto shift = magnitude - sub_bucket_bits;
+    auto sub_bucket = (value >> shift) - sub_bucket_count;
+    return (shift + 1) * sub_bucket_count + sub_bucket;
+}
+
+sdb::hdr_histogram::bucket sdb::hdr_histogram::bounds_of(std::size_t index) {
+    if (index < sub_bucket_count) return { index, index, 0 };
+    auto shift = index / sub_bucket_count - 1;
+    auto sub_bucket = index % sub_bucket_count + sub_bucket_count;
+    std::uint64_t low = sub_bucket << shift;
+    return { low, low + ((std::uint64_t{ 1 } << shift) - 1), 0 };
+}
+
+void sdb::hdr_histogram::add(std::uint64_t value) {
+    auto index = index_of(value);
+    if (index >= counts_.size()) counts_.resize(index + 1);
+    ++counts_[index];
+
+    min_ = count_ == 0 ? value : std::min(min_, value);
+    max_ = std::max(max_, value);
+    ++count_;
+    total_ += value;
+}
+
+std::uint64_t sdb::hdr_histogram::percentile(double fraction) const {
+    if (count_ == 0) return 0;
+    auto wanted = static_cast<std::uint64_t>(std::ceil(fraction * count_));
+    wanted = std::clamp<std::uint64_t>(wanted, 1, count_);
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < counts_.size(); ++i) {
+        seen += counts_[i];
+        if (seen >= wanted) return std::min(bounds_of(i).high, max_);
+    }
+    return max_;
+}
+
+std::vector<sdb::hdr_histogram::bucket> sdb::hdr_histogram::buckets() const {
+    std::vector<bucket> ret;
+    for (std::size_t i = 0; i < counts_.size(); ++i) {
+        if (counts_[i] == 0) continue;
+        auto bounds = bounds_of(i);
+        bounds.count = counts_[i];
+        ret.push_back(bounds);
+    }
+    return ret;
+}
+
+void sdb::latency_tracer::trace(virt_addr entry) {
+    process_->create_breakpoint_site(entry, false, true).enable();
+    entries_.insert(entry.addr());
+}
+
+void sdb::latency_tracer::run(std::function<bool()> stop_requested) {
+    // Only the thread hitting a breakpoint needs to stop for it
+    process_->set_stop_mode(stop_mode::non_stop);
+    if (process_->state() == process_state::stopped) {
+        process_->resume_all_threads();
+    }
+
+    while (true) {
+        auto reason = process_->wait_on_signal();
+        if (reason.reason == process_state::exited or
+            reason.reason == process_state::terminated) {
+            exit_reason_ = reason;
+            return;
+        }
+
+        auto is_ours = record(reason);
+        if (stop_requested and stop_requested()) return;
+
+        if (is_ours or reason.info == SIGTRAP) {
+            process_->resume();
+        }
+        else {
+            process_->resume(reason.info);
+        }
+    }
+}
+
+bool sdb::latency_tracer::record(const stop_reason& reason) {
+    if (reason.reason != process_state::stopped or
+        reason.trap_reason != trap_type::software_break) {
+        return false;
+    }
+
+    using namespace std::chrono;
+    std::uint64_t now = duration_cast<nanoseconds>(
+        steady_clock::now() - start_).count();
+    auto& regs = process_->get_registers(reason.tid);
+    virt_addr pc{ regs.read_by_id_as<std::uint64_t>(register_id::rip) };
+    auto rsp = regs.read_by_id_as<std::uint64_t>(register_id::rsp);
+    auto is_ours = false;
+
+    if (return_sites_.count(pc.addr())) {
+        is_ours = true;
+        // Calls left by longjmp or an exception are deeper than the one
+        // returning, and will never return themselves
+        auto& calls = open_calls_[reason.tid];
+        while (!calls.empty() and calls.back().frame_rsp + 8 < rsp) {
+            release_return(calls.back().return_address);
+            calls.pop_back();
+        }
+        if (!calls.empty() and calls.back().frame_rsp + 8 == rsp and
+            calls.back().return_address == pc) {
+            auto& call = calls.back();
+            latencies_[call.entry][reason.tid].add(now - call.timestamp);
+            release_return(call.return_address);
+            calls.pop_back();
+        }
+    }
+
+    if (entries_.count(pc.addr())) {
+        is_ours = true;
+        virt_addr return_address{
+            process_->read_memory_as<std::uint64_t>(virt_addr{ rsp }) };
+        plant_return(return_address);
+        open_calls_[reason.tid].push_back({ pc, return_address, rsp, now });
+    }
+    return is_ours;
+}
+
+void sdb::latency_tracer::plant_return(virt_addr address) {
+    auto it = return_sites_.find(address.addr());
+    if (it != end(return_sites_)) {
+        ++it->second.waiting;
+        return;
+    }
+
+    auto& sites = process_->breakpoint_sites();
+    auto owned = !sites.contains_address(address);
+    if (owned) {
+        process_->create_breakpoint_site(address, false, true).enable();
+    }
+    return_sites_[address.addr()] = { 1, owned };
+}
+
+void sdb::latency_tracer::release_return(virt_addr address) {
+    auto it = return_sites_.find(address.addr());
+    if (it == end(return_sites_) or --it->second.waiting > 0) return;
+
+    if (it->second.owned) {
+        process_->breakpoint_sites().remove_by_address(address);
+    }
+    return_sites_.erase(it);
+}
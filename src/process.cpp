@@ -1,14 +1,32 @@
 #include <libsdb/error.hpp>
 #include <libsdb/process.hpp>
+#include <libsdb/instruction_trace.hpp>
 #include <libsdb/pipe.hpp>
+#include <libsdb/disassembler.hpp>
 #include <sys/ptrace.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <optional>
 #include <sys/personality.h>
 #include <sys/uio.h>
+#include <sys/prctl.h>
+#include <linux/seccomp.h>
+#include <linux/filter.h>
+#include <linux/audit.h>
 #include <libsdb/bit.hpp>
+#include <libsdb/parse.hpp>
 #include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <filesystem>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <mutex>
 
 namespace {
     void exit_with_perror(
@@ -38,39 +56,461 @@ namespace {
         }
     }
 
-    int find_free_stoppoint_register(std::uint64_t control_register) {
-        for (auto i = 0; i < 4; ++i) {
-            if ((control_register & (0b11 << (i * 2))) == 0) {
-                return i;
-            }
+    // Enable, mode and size bits of a debug register in dr7
+    std::uint64_t stoppoint_control_mask(std::size_t index) {
+        return (std::uint64_t{ 0b11 } << (index * 2)) |
+            (std::uint64_t{ 0b1111 } << (index * 4 + 16));
+    }
+
+    long ptrace_options(bool follow_forks) {
+        long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP |
+            PTRACE_O_TRACECLONE;
+        if (follow_forks) {
+            options |= PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+                PTRACE_O_TRACEEXEC;
         }
-        sdb::error::send("No remaining hardware debug registers");
+        return options;
+    }
+
+    void set_ptrace_options(pid_t pid, bool follow_forks = false) {
+        if (ptrace(PTRACE_SETOPTIONS, pid, nullptr,
+            ptrace_options(follow_forks)) < 0) {
+            sdb::error::send_errno("Failed to set ptrace options");
+        }
+    }
+
+    bool is_seccomp_stop(int wait_status) {
+        return WIFSTOPPED(wait_status) and
+            (wait_status >> 8) == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8));
+    }
+
+    bool is_clone_stop(int wait_status) {
+        return WIFSTOPPED(wait_status) and
+            (wait_status >> 8) == (SIGTRAP | (PTRACE_EVENT_CLONE << 8));
     }
 
-    void set_ptrace_options(pid_t pid) {
-        if (ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD) < 0)
-        {
-            sdb::error::send_errno("Failed to set TRACESYSGOOD option");
+    // The PTRACE_EVENT_* of an event stop, or 0
+    int ptrace_event(int wait_status) {
+        if (!WIFSTOPPED(wait_status) or WSTOPSIG(wait_status) != SIGTRAP) {
+            return 0;
         }
+        return wait_status >> 16;
+    }
+
+    bool is_sigstop(int wait_status) {
+        return WIFSTOPPED(wait_status) and WSTOPSIG(wait_status) == SIGSTOP;
+    }
+
+    // waitpid reports on every tracee of the debugger, so the process
+    // objects share a list of those alive, and statuses collected for a
+    // thread which another of them owns, or none does yet, are parked here
+    // until the owner asks for them. They are dropped with their owner
+    struct wait_registry {
+        std::mutex mutex;
+        std::vector<const sdb::process*> processes;
+        std::vector<std::pair<pid_t, int>> parked;
+    };
+
+    wait_registry& waits() {
+        static wait_registry registry;
+        return registry;
+    }
+
+    std::optional<int> take_parked_status(pid_t tid) {
+        auto& registry = waits();
+        std::lock_guard lock(registry.mutex);
+        auto parked = std::find_if(
+            begin(registry.parked), end(registry.parked),
+            [&](auto& entry) { return entry.first == tid; });
+        if (parked == end(registry.parked)) return std::nullopt;
+
+        auto status = parked->second;
+        registry.parked.erase(parked);
+        return status;
+    }
+
+    int wait_for_thread(pid_t tid) {
+        if (auto parked = take_parked_status(tid)) return *parked;
+
+        int wait_status;
+        if (waitpid(tid, &wait_status, __WALL) < 0) {
+            sdb::error::send_errno("waitpid failed");
+        }
+        return wait_status;
+    }
+
+    // The parent from /proc/<pid>/stat, whose second field may itself hold
+    // spaces and parentheses
+    std::optional<pid_t> parent_of(pid_t pid) {
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string line;
+        if (!std::getline(stat, line)) return std::nullopt;
+
+        auto name_end = line.rfind(')');
+        if (name_end == std::string::npos) return std::nullopt;
+        std::istringstream fields(line.substr(name_end + 1));
+        char state;
+        pid_t parent;
+        if (!(fields >> state >> parent)) return std::nullopt;
+        return parent;
+    }
+
+    // Builds a classic BPF program which returns SECCOMP_RET_TRACE for the
+    // given (sorted) syscalls and lets everything else through untouched
+    std::vector<sock_filter> make_syscall_filter(
+        const std::vector<int>& to_trace) {
+        // Jump offsets are 8 bits wide
+        if (to_trace.size() > 255) {
+            sdb::error::send("Too many syscalls to filter");
+        }
+
+        std::vector<sock_filter> filter = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch)),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)),
+        };
+
+        auto n = to_trace.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            auto jump_to_trace = static_cast<std::uint8_t>(n - i);
+            filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                static_cast<std::uint32_t>(to_trace[i]), jump_to_trace, 0));
+        }
+        filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+        filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+        return filter;
+    }
+
+    void install_syscall_filter(
+        sdb::pipe& channel, std::vector<sock_filter>& filter) {
+        sock_fprog program{
+            static_cast<unsigned short>(filter.size()), filter.data() };
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+            exit_with_perror(channel, "Could not set no_new_privs");
+        }
+        if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) < 0) {
+            exit_with_perror(channel, "Could not install syscall filter");
+        }
+    }
+
+    // Runs a child which stopped itself before installing its seccomp filter
+    // up to its exec, so that PTRACE_O_TRACESECCOMP is set before the filter
+    // can trap anything, including the execve itself
+    void await_filtered_exec(pid_t pid) {
+        int wait_status;
+        if (waitpid(pid, &wait_status, 0) < 0) {
+            sdb::error::send_errno("waitpid failed");
+        }
+        if (!WIFSTOPPED(wait_status)) return;
+
+        set_ptrace_options(pid);
+        do {
+            if (ptrace(PTRACE_CONT, pid, nullptr, nullptr) < 0) {
+                sdb::error::send_errno("Could not resume");
+            }
+            if (waitpid(pid, &wait_status, 0) < 0) {
+                sdb::error::send_errno("waitpid failed");
+            }
+        } while (is_seccomp_stop(wait_status));
     }
 }
 
 sdb::stop_reason sdb::process::step_instruction() {
-    std::optional<breakpoint_site*> to_reenable;
-    auto pc = get_pc();
-    if (breakpoint_sites_.enabled_stoppoint_at_address(pc)) {
-        auto& bp = breakpoint_sites_.get_by_address(pc);
-        bp.disable();
-        to_reenable = &bp;
+    sync_debug_registers();
+    auto& thread = threads_.at(current_thread_);
+    thread.regs->flush();
+    memory_cache_.clear();
+
+    // Only this thread runs, so wait on it alone
+    auto tid = thread.tid;
+    auto wait_status = step_over_breakpoint(thread);
+    if (!wait_status) {
+        wait_status = single_step_thread(thread);
+    }
+    auto reason = handle_wait_status(tid, *wait_status);
+    if (!reason) {
+        reason = wait_on_signal();
+    }
+    return *reason;
+}
+
+sdb::stop_reason sdb::process::trace_instructions(
+    std::size_t count, instruction_trace& trace)
+{
+    if (count == 0) {
+        error::send("Nothing to trace");
+    }
+
+    auto& thread = threads_.at(current_thread_);
+    thread.regs->flush();
+    memory_cache_.clear();
+
+    std::vector<breakpoint_site*> to_reenable;
+    breakpoint_sites_.for_each([&](auto& site) {
+        if (site.is_enabled()) {
+            site.disable();
+            to_reenable.push_back(&site);
+        }
+    });
+    sync_debug_registers();
+    thread.regs->flush();
+
+    auto tid = thread.tid;
+    auto record_registers = trace.records_registers();
+    std::optional<stop_reason> reason;
+    std::optional<int> pending_status;
+    std::size_t steps = 0;
+    while (true) {
+        int wait_status;
+        if (pending_status) {
+            wait_status = *pending_status;
+            pending_status.reset();
+        }
+        else {
+            if (ptrace(PTRACE_SINGLESTEP, tid, nullptr, nullptr) < 0) {
+                error::send_errno("Could not single step");
+            }
+            wait_status = wait_for_thread(tid);
+            if (thread.pending_interrupt and is_interrupt_stop(wait_status)) {
+                thread.pending_interrupt = false;
+                continue;
+            }
+        }
+
+        // Anything but a plain step, such as a signal or an exit, ends the
+        // trace and is reported as usual
+        bool plain_step = WIFSTOPPED(wait_status) and
+            WSTOPSIG(wait_status) == SIGTRAP and ptrace_event(wait_status) == 0;
+        if (plain_step and steps < count) {
+            if (record_registers) {
+                user_regs_struct regs;
+                if (ptrace(PTRACE_GETREGS, tid, nullptr, &regs) < 0) {
+                    error::send_errno("Could not read GPR registers");
+                }
+                trace.append(regs);
+            }
+            else {
+                errno = 0;
+                auto rip = ptrace(PTRACE_PEEKUSER, tid,
+                    offsetof(user, regs.rip), nullptr);
+                if (errno != 0) {
+                    error::send_errno("Could not read rip");
+                }
+                trace.append(static_cast<std::uint64_t>(rip));
+            }
+            if (++steps < count) continue;
+        }
+
+        thread.regs->invalidate();
+        reason = handle_wait_status(tid, wait_status);
+        if (reason or !threads_.count(tid)) break;
+
+        // Stops which aren't reported, such as clone events or ignored
+        // watchpoint hits, resume the thread. Stop it again rather than
+        // let it run past the disabled breakpoints
+        stop_running_threads();
+        if (!threads_.count(tid)) break;
+        pending_status = std::exchange(thread.pending_status, std::nullopt);
     }
 
-    if (ptrace(PTRACE_SINGLESTEP, pid_, nullptr, nullptr) < 0) {
-        error::send_errno("Could not single step");
+    if (!reason) {
+        // The traced thread exited, which ends the trace, and the rest of
+        // the process carries on as it would have
+        for (auto site : to_reenable) {
+            site->enable();
+        }
+        resume();
+        return wait_on_signal();
+    }
+
+    if (state_ == process_state::stopped) {
+        for (auto site : to_reenable) {
+            site->enable();
+        }
+    }
+    return *reason;
+}
+
+int sdb::process::single_step_thread(thread_state& thread) {
+    std::vector<std::uint64_t> unprotected;
+    int wait_status;
+    while (true) {
+        if (ptrace(PTRACE_SINGLESTEP, thread.tid, nullptr, nullptr) < 0) {
+            error::send_errno("Could not single step");
+        }
+        thread.state = process_state::running;
+        wait_status = wait_for_thread(thread.tid);
+        thread.state = process_state::stopped;
+        thread.regs->invalidate();
+
+        // An earlier interrupt is delivered before the step happens
+        if (thread.pending_interrupt and is_interrupt_stop(wait_status)) {
+            thread.pending_interrupt = false;
+            continue;
+        }
+
+        // Accesses to pages protected for software watchpoints are rerun
+        // with the pages unprotected until the instruction completes
+        if (auto fault = software_watch_fault(thread.tid, wait_status)) {
+            auto page = *fault & ~std::uint64_t{ 0xfff };
+            protect_page(thread, page, protected_pages_.at(page).original);
+            unprotected.push_back(page);
+            thread.watch_faults.push_back(*fault);
+            continue;
+        }
+        break;
+    }
+
+    for (auto page : unprotected) {
+        protect_page(thread, page, protected_pages_.at(page).applied);
+    }
+    return wait_status;
+}
+
+sdb::stop_reason sdb::process::step_over() {
+    disassembler disas(*this);
+    auto instructions = disas.disassemble(1);
+    if (instructions.empty() or
+        instructions[0].kind != instruction_kind::call) {
+        return step_instruction();
+    }
+
+    auto& call = instructions[0];
+    auto rsp = get_registers().read_by_id_as<std::uint64_t>(register_id::rsp);
+    return run_until_return(call.address + call.length, rsp);
+}
+
+sdb::stop_reason sdb::process::step_out() {
+    disassembler disas(*this);
+    auto instructions = disas.disassemble(1);
+    auto kind = instructions.empty() ?
+        instruction_kind::other : instructions[0].kind;
+
+    auto& regs = get_registers();
+    auto rsp = regs.read_by_id_as<std::uint64_t>(register_id::rsp);
+    auto rbp = regs.read_by_id_as<std::uint64_t>(register_id::rbp);
+
+    // Until the prologue has run, the return address is found relative to
+    // the stack pointer rather than the frame pointer
+    virt_addr return_slot{ rbp + 8 };
+    if (kind == instruction_kind::ret or
+        kind == instruction_kind::function_entry) {
+        return_slot = virt_addr{ rsp };
+    }
+    else if (kind == instruction_kind::frame_setup) {
+        return_slot = virt_addr{ rsp + 8 };
+    }
+
+    if (auto return_address = checked_return_address(return_slot, rsp)) {
+        return run_until_return(*return_address, return_slot.addr() + 8);
+    }
+
+    // Without a frame to trust, as in code which uses rbp for something
+    // else, step over calls until a ret has run
+    while (true) {
+        auto next = disas.disassemble(1);
+        auto at_ret = !next.empty() and next[0].kind == instruction_kind::ret;
+        auto reason = step_over();
+        if (at_ret or reason.reason != process_state::stopped or
+            reason.trap_reason != trap_type::single_step) {
+            return reason;
+        }
+    }
+}
+
+std::optional<sdb::virt_addr> sdb::process::checked_return_address(
+    virt_addr slot, std::uint64_t rsp)
+{
+    // The slot has to be in the live part of the stack
+    auto stack = mapping_containing(rsp);
+    if (!stack or slot.addr() < rsp or slot.addr() + 8 > stack->second) {
+        return std::nullopt;
+    }
+
+    // and what it holds has to follow a call, in any of its encodings
+    auto return_address = virt_addr{ read_memory_as<std::uint64_t>(slot) };
+    disassembler disas(*this);
+    for (std::uint8_t length = 2; length <= 7; ++length) {
+        try {
+            auto call = disas.disassemble(1, return_address - length);
+            if (!call.empty() and call[0].kind == instruction_kind::call and
+                call[0].length == length) {
+                return return_address;
+            }
+        }
+        catch (const error&) {}
+    }
+    return std::nullopt;
+}
+
+std::optional<std::pair<std::uint64_t, std::uint64_t>>
+sdb::process::mapping_containing(std::uint64_t address) const {
+    std::ifstream maps("/proc/" + std::to_string(pid_) + "/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        std::istringstream fields(line);
+        std::string range;
+        fields >> range;
+
+        auto dash = range.find('-');
+        auto low = std::stoull(range.substr(0, dash), nullptr, 16);
+        auto high = std::stoull(range.substr(dash + 1), nullptr, 16);
+        if (low <= address and address < high) return std::pair{ low, high };
+    }
+    return std::nullopt;
+}
+
+sdb::stop_reason sdb::process::run_until_return(
+    virt_addr return_address, std::uint64_t frame_rsp)
+{
+    breakpoint_site* site;
+    bool created = !breakpoint_sites_.contains_address(return_address);
+    if (created) {
+        site = &create_breakpoint_site(
+            return_address, /*hardware=*/false, /*internal=*/true);
     }
+    else {
+        site = &breakpoint_sites_.get_by_address(return_address);
+    }
+    bool was_enabled = site->is_enabled();
+    site->enable();
+
+    auto at_return_address = [&](const stop_reason& reason) {
+        return reason.reason == process_state::stopped and
+            reason.trap_reason == trap_type::software_break and
+            get_pc() == return_address;
+    };
+    // Other threads may run through the same return address too
+    auto tid = current_thread_;
+    auto not_our_return = [&](const stop_reason& reason) {
+        return reason.tid != tid or
+            get_registers().read_by_id_as<std::uint64_t>(
+                register_id::rsp) < frame_rsp;
+    };
+
+    resume();
     auto reason = wait_on_signal();
+    // Recursive calls hit the same return address further down the stack,
+    // so keep going until the frame we care about is popped
+    while (at_return_address(reason) and not_our_return(reason)) {
+        resume();
+        reason = wait_on_signal();
+    }
+    auto returned = at_return_address(reason);
+
+    if (state_ == process_state::stopped) {
+        if (created) {
+            breakpoint_sites_.remove_by_address(return_address);
+        }
+        else if (!was_enabled) {
+            site->disable();
+        }
+    }
 
-    if (to_reenable) {
-        to_reenable.value()->enable();
+    // Reaching our own breakpoint is the end of a step, not a break
+    if (returned and created) {
+        reason.trap_reason = trap_type::single_step;
     }
     return reason;
 }
@@ -78,9 +518,22 @@ sdb::stop_reason sdb::process::step_instruction() {
 std::unique_ptr<sdb::process> sdb::process::launch(
     std::filesystem::path path, 
     bool debug,
-    std::optional<int> stdout_replacement) {
+    std::optional<int> stdout_replacement,
+    syscall_catch_policy syscall_policy) {
     pipe channel(/*close_on_exec=*/true);
 
+    std::vector<int> syscall_filter;
+    std::vector<sock_filter> filter_program;
+    if (debug and
+        syscall_policy.get_mode() == syscall_catch_policy::mode::some) {
+        syscall_filter = syscall_policy.get_to_catch();
+        std::sort(begin(syscall_filter), end(syscall_filter));
+        syscall_filter.erase(
+            std::unique(begin(syscall_filter), end(syscall_filter)),
+            end(syscall_filter));
+        filter_program = make_syscall_filter(syscall_filter);
+    }
+
     pid_t pid;
     if ((pid = fork()) < 0) {
         //error: fork failed
@@ -103,6 +556,10 @@ std::unique_ptr<sdb::process> sdb::process::launch(
             //error: Tracing failed
             exit_with_perror(channel, "Tracing failed");
         }
+        if (!filter_program.empty()) {
+            raise(SIGSTOP);
+            install_syscall_filter(channel, filter_program);
+        }
         if (execlp(path.c_str(), path.c_str(), nullptr) < 0) {
             //error: exec failed
             exit_with_perror(channel, "exec failed");
@@ -110,6 +567,9 @@ std::unique_ptr<sdb::process> sdb::process::launch(
     }
 
     channel.close_write();
+    if (!filter_program.empty()) {
+        await_filtered_exec(pid);
+    }
     auto data = channel.read();
     channel.close_read();
 
@@ -123,8 +583,12 @@ std::unique_ptr<sdb::process> sdb::process::launch(
         new sdb::process(pid, /*terminate_on_end=*/true, debug));
 
     if (debug) {
-        proc->wait_on_signal();
-        set_ptrace_options(proc->pid());
+        if (filter_program.empty()) {
+            proc->wait_on_signal();
+            set_ptrace_options(proc->pid());
+        }
+        proc->syscall_filter_ = std::move(syscall_filter);
+        proc->set_syscall_catch_policy(std::move(syscall_policy));
     }
 
     return proc;
@@ -145,136 +609,1271 @@ std::unique_ptr<sdb::process> sdb::process::attach(pid_t pid) {
     proc->wait_on_signal();
 
     set_ptrace_options(proc->pid());
+    proc->attach_threads();
 
     return proc;
 }
 
+std::unique_ptr<sdb::process> sdb::process::seize(pid_t pid) {
+    if (pid == 0) {
+        error::send("Invalid PID");
+    }
+    if (ptrace(PTRACE_SEIZE, pid, nullptr, ptrace_options(false)) < 0) {
+        error::send_errno("Could not seize");
+    }
+
+    std::unique_ptr<sdb::process> proc (
+        new sdb::process(pid, /*terminate_on_end=*/false, /*attached=*/true));
+    proc->seized_ = true;
+    proc->state_ = process_state::running;
+    proc->threads_.at(pid).state = process_state::running;
+    proc->attach_threads();
+
+    return proc;
+}
+
+void sdb::process::attach_threads() {
+    auto task_dir = "/proc/" + std::to_string(pid_) + "/task";
+
+    // Threads which are still running may create more while we go, so
+    // keep scanning until a pass finds nothing new
+    bool found_new = true;
+    while (found_new) {
+        found_new = false;
+        for (auto& entry : std::filesystem::directory_iterator(task_dir)) {
+            auto tid = static_cast<pid_t>(
+                std::stoi(entry.path().filename().string()));
+            if (threads_.count(tid)) continue;
+
+            if (seized_) {
+                // Seized threads keep running
+                if (ptrace(PTRACE_SEIZE, tid, nullptr,
+                    ptrace_options(follow_forks_)) < 0) continue;
+                found_new = true;
+                add_thread(tid).state = process_state::running;
+                continue;
+            }
+
+            // The thread may have exited since the scan
+            if (ptrace(PTRACE_ATTACH, tid, nullptr, nullptr) < 0) continue;
+            found_new = true;
+
+            auto wait_status = wait_for_thread(tid);
+            if (!WIFSTOPPED(wait_status)) continue;
+            set_ptrace_options(tid);
+            auto& thread = add_thread(tid);
+
+            // A thread caught in a group-stop reports that instead of our
+            // SIGSTOP, which is then still queued
+            siginfo_t info;
+            if (ptrace(PTRACE_GETSIGINFO, tid, nullptr, &info) < 0) {
+                thread.pending_interrupt = true;
+            }
+        }
+    }
+}
+
 sdb::process::~process() {
+    for (auto& [id, copy] : checkpoints_) {
+        discard_parked_copy(*copy);
+    }
+
     if (pid_ != 0) {
         int status;
         if (is_attached_) {
-            if (state_ == process_state::running) {
-                kill(pid_, SIGSTOP);
-                waitpid(pid_, &status, 0);
+            // In non-stop mode threads may run even if the process is
+            // reported as stopped
+            try {
+                stop_running_threads();
+            }
+            catch (const error&) {}
+            auto alive = state_ != process_state::exited and
+                state_ != process_state::terminated;
+            if (alive and !terminate_on_end_) {
+                try {
+                    remove_stoppoints_for_detach();
+                }
+                catch (const error&) {}
+            }
+            for (auto& [tid, thread] : threads_) {
+                if (alive) {
+                    try {
+                        thread.regs->flush();
+                    }
+                    catch (const error&) {}
+                }
+                ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
             }
-            ptrace(PTRACE_DETACH, pid_, nullptr, nullptr);
             kill(pid_, SIGCONT);
         }
 
-        if (terminate_on_end_) {
-            kill(pid_, SIGKILL);
-            waitpid(pid_, &status, 0);
+        if (terminate_on_end_) {
+            kill(pid_, SIGKILL);
+            waitpid(pid_, &status, 0);
+        }
+    }
+
+    if (memory_fd_ != -1) {
+        close(memory_fd_);
+    }
+    if (pidfd_ != -1) {
+        close(pidfd_);
+    }
+    unregister_for_waits();
+}
+
+void sdb::process::remove_stoppoints_for_detach() {
+    // Threads which hit a breakpoint that was never reported need to run
+    // the original instruction once it is restored
+    for (auto& [tid, thread] : threads_) {
+        if (!thread.pending_status or
+            WSTOPSIG(*thread.pending_status) != SIGTRAP) continue;
+
+        siginfo_t info;
+        if (ptrace(PTRACE_GETSIGINFO, tid, nullptr, &info) < 0 or
+            info.si_code != SI_KERNEL) continue;
+
+        auto pc = virt_addr{ thread.regs->read_by_id_as<std::uint64_t>(
+            register_id::rip) } - 1;
+        if (breakpoint_sites_.enabled_stoppoint_at_address(pc)) {
+            thread.regs->write_by_id(register_id::rip, pc.addr());
+        }
+    }
+
+    breakpoint_sites_.for_each([](auto& site) { site.disable(); });
+    watchpoints_.for_each([](auto& point) { point.disable(); });
+    sync_debug_registers();
+}
+
+sdb::stop_reason::stop_reason(int wait_status) {
+    if (WIFEXITED(wait_status)) {
+        reason = process_state::exited;
+        info = WEXITSTATUS(wait_status);
+    } else if (WIFSIGNALED(wait_status)) {
+        reason = process_state::terminated;
+        info = WTERMSIG(wait_status);
+    } else if (WIFSTOPPED(wait_status)) {
+        reason = process_state::stopped;
+        info = WSTOPSIG(wait_status);
+    }
+}
+
+sdb::stop_reason sdb::process::wait_on_signal() {
+    while (true) {
+        auto [tid, wait_status] = *next_wait_status(/*block=*/true);
+        if (auto reason = handle_wait_status(tid, wait_status)) {
+            return *reason;
+        }
+    }
+}
+
+std::optional<sdb::stop_reason> sdb::process::try_wait() {
+    while (auto next = next_wait_status(/*block=*/false)) {
+        if (auto reason = handle_wait_status(next->first, next->second)) {
+            return reason;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::pair<pid_t, int>>
+sdb::process::next_wait_status(bool block) {
+    if (auto ready = take_ready_status()) return ready;
+
+    while (true) {
+        auto next = reap_wait_status(block);
+        if (!next) return std::nullopt;
+
+        if (owns_thread(next->first)) return next;
+        park_wait_status(next->first, next->second);
+    }
+}
+
+std::optional<std::pair<pid_t, int>>
+sdb::process::reap_wait_status(bool block) {
+    auto delay = std::chrono::microseconds{ 10 };
+    constexpr auto max_delay = std::chrono::microseconds{ 10'000 };
+    while (true) {
+        // Look before reaping, since the status of a child which isn't
+        // ours to trace belongs to whoever else waits for it
+        siginfo_t info{};
+        auto options = WEXITED | WSTOPPED | WNOWAIT | __WALL;
+        if (waitid(P_ALL, 0, &info, options | (block ? 0 : WNOHANG)) < 0) {
+            error::send_errno("waitid failed");
+        }
+        if (info.si_pid == 0) return std::nullopt;
+
+        auto tid = info.si_pid;
+        if (!is_unclaimed_child(tid)) {
+            int wait_status;
+            if (waitpid(tid, &wait_status, __WALL) < 0) {
+                error::send_errno("waitpid failed");
+            }
+            return std::pair{ tid, wait_status };
+        }
+
+        // That child would be first in line every time, so until it is
+        // reaped our own threads are polled one by one
+        if (auto ready = poll_registered_threads()) return ready;
+        if (!block) return std::nullopt;
+        std::this_thread::sleep_for(delay);
+        delay = std::min(delay * 2, max_delay);
+    }
+}
+
+bool sdb::process::is_unclaimed_child(pid_t pid) {
+    auto& registry = waits();
+    {
+        std::lock_guard lock(registry.mutex);
+        for (auto proc : registry.processes) {
+            if (proc->owns_thread(pid)) return false;
+        }
+    }
+    // New children of tracees are ours before any object owns them, but
+    // children of the debugger itself are either owned or not traced,
+    // e.g. a program we launched and detached from
+    return parent_of(pid) == getpid();
+}
+
+std::optional<std::pair<pid_t, int>> sdb::process::poll_registered_threads() {
+    std::vector<pid_t> tids;
+    {
+        auto& registry = waits();
+        std::lock_guard lock(registry.mutex);
+        for (auto proc : registry.processes) {
+            for (auto& [tid, thread] : proc->threads_) {
+                tids.push_back(tid);
+            }
+            // Threads whose first stop beat their clone event
+            std::error_code ec;
+            auto tasks = "/proc/" + std::to_string(proc->pid_) + "/task";
+            for (auto& entry :
+                std::filesystem::directory_iterator(tasks, ec)) {
+                auto tid = to_integral<pid_t>(
+                    entry.path().filename().string());
+                if (tid and !proc->threads_.count(*tid)) {
+                    tids.push_back(*tid);
+                }
+            }
+        }
+    }
+
+    for (auto tid : tids) {
+        int wait_status;
+        if (waitpid(tid, &wait_status, __WALL | WNOHANG) == tid) {
+            return std::pair{ tid, wait_status };
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::pair<pid_t, int>> sdb::process::take_ready_status() {
+    // Stops collected while halting threads are reported first
+    for (auto& [tid, thread] : threads_) {
+        if (thread.pending_status) {
+            auto wait_status = *thread.pending_status;
+            thread.pending_status.reset();
+            return std::pair{ tid, wait_status };
+        }
+    }
+
+    auto& registry = waits();
+    std::lock_guard lock(registry.mutex);
+    auto parked = std::find_if(begin(registry.parked), end(registry.parked),
+        [&](auto& entry) { return owns_thread(entry.first); });
+    if (parked != end(registry.parked)) {
+        auto ret = *parked;
+        registry.parked.erase(parked);
+        return ret;
+    }
+    return std::nullopt;
+}
+
+void sdb::process::park_wait_status(pid_t tid, int wait_status) {
+    auto& registry = waits();
+    std::lock_guard lock(registry.mutex);
+    registry.parked.emplace_back(tid, wait_status);
+}
+
+void sdb::process::register_for_waits() {
+    auto& registry = waits();
+    std::lock_guard lock(registry.mutex);
+    registry.processes.push_back(this);
+}
+
+void sdb::process::unregister_for_waits() {
+    auto& registry = waits();
+    std::lock_guard lock(registry.mutex);
+    registry.processes.erase(std::remove(
+        begin(registry.processes), end(registry.processes), this),
+        end(registry.processes));
+    drop_parked_statuses();
+    // Whatever is left can no longer be claimed by anyone
+    if (registry.processes.empty()) {
+        registry.parked.clear();
+    }
+}
+
+void sdb::process::drop_parked_statuses() const {
+    auto& registry = waits();
+    registry.parked.erase(std::remove_if(
+        begin(registry.parked), end(registry.parked),
+        [&](auto& entry) { return threads_.count(entry.first) != 0; }),
+        end(registry.parked));
+}
+
+bool sdb::process::owns_thread(pid_t tid) const {
+    if (threads_.count(tid)) return true;
+    // New threads can report their first stop before we hear about them
+    // from the clone event
+    return std::filesystem::exists(
+        "/proc/" + std::to_string(pid_) + "/task/" + std::to_string(tid));
+}
+
+sdb::thread_state& sdb::process::add_thread(pid_t tid) {
+    auto& thread = threads_[tid];
+    thread.tid = tid;
+    thread.regs.reset(new registers(*this, tid));
+
+    // Threads don't inherit debug registers, so give new ones the hardware
+    // stoppoints set so far
+    for (auto i : { 0, 1, 2, 3, 7 }) {
+        if (debug_registers_[i] != 0) {
+            thread.regs->write_by_id(static_cast<register_id>(
+                static_cast<int>(register_id::dr0) + i), debug_registers_[i]);
+        }
+    }
+    return thread;
+}
+
+void sdb::process::set_current_thread(pid_t tid) {
+    if (!threads_.count(tid)) {
+        error::send("No such thread");
+    }
+    current_thread_ = tid;
+}
+
+void sdb::process::follow_forks() {
+    follow_forks_ = true;
+    for (auto& [tid, thread] : threads_) {
+        set_ptrace_options(tid, /*follow_forks=*/true);
+    }
+}
+
+std::unique_ptr<sdb::process> sdb::process::adopt_fork_child(
+    const stop_reason& fork_stop, bool inherit_breakpoints)
+{
+    // The child is traced from birth and starts with a SIGSTOP of its own
+    auto child = *fork_stop.child_pid;
+    wait_for_thread(child);
+
+    std::unique_ptr<process> proc(
+        new process(child, terminate_on_end_, /*is_attached=*/true));
+    proc->follow_forks_ = follow_forks_;
+    proc->stop_mode_ = stop_mode_;
+    proc->syscall_filter_ = syscall_filter_;
+    // Scratch pages are copied into the child along with everything else
+    proc->displaced_ = displaced_;
+    proc->scratch_pages_ = scratch_pages_;
+    proc->syscall_instruction_ = syscall_instruction_;
+    // The child's pages are protected as ours are. Watchpoints it inherits
+    // count them again; the rest are restored below
+    proc->protected_pages_ = protected_pages_;
+    for (auto& [page, entry] : proc->protected_pages_) {
+        entry.writes = 0;
+        entry.accesses = 0;
+        entry.executes = 0;
+    }
+    proc->set_syscall_catch_policy(syscall_catch_policy_);
+
+    // A vfork child runs in our memory, so it sees our breakpoints whatever
+    // we do; otherwise it has a copy of every patched byte to keep or undo
+    auto inherit = inherit_breakpoints or fork_stop.shares_memory;
+    breakpoint_sites_.for_each([&](auto& site) {
+        if (inherit and !site.is_internal()) {
+            auto& copy = proc->create_breakpoint_site(
+                site.address(), site.is_hardware());
+            if (!site.is_enabled()) return;
+            if (site.is_hardware()) {
+                copy.enable();
+            }
+            else {
+                copy.saved_data_ = site.saved_data_;
+                copy.is_enabled_ = true;
+            }
+        }
+        else if (site.is_enabled() and !site.is_hardware() and
+                 !fork_stop.shares_memory) {
+            proc->patch_memory(site.address(), { &site.saved_data_, 1 });
+        }
+    });
+    if (inherit) {
+        watchpoints_.for_each([&](auto& point) {
+            auto& copy = proc->create_watchpoint(
+                point.address(), point.mode(), point.size());
+            if (point.is_enabled()) copy.enable();
+        });
+    }
+    if (!fork_stop.shares_memory) {
+        // Hold the pages aside while updating, as updating forgets them
+        for (auto& [page, entry] : std::map(proc->protected_pages_)) {
+            proc->update_page_protection(page);
+        }
+    }
+    return proc;
+}
+
+void sdb::process::reset_after_exec() {
+    // Other threads are gone, and every patch and debug register went
+    // with the old image
+    for (auto it = begin(threads_); it != end(threads_);) {
+        it = it->first == pid_ ? std::next(it) : threads_.erase(it);
+    }
+    current_thread_ = pid_;
+    auto& thread = threads_.at(pid_);
+    thread.regs.reset(new registers(*this, pid_));
+    thread.state = process_state::stopped;
+    thread.pending_status.reset();
+    thread.pending_interrupt = false;
+    thread.expecting_syscall_exit = false;
+
+    debug_registers_ = {};
+    hardware_stoppoints_.clear();
+    backed_stoppoints_.clear();
+    breakpoint_sites_.clear();
+    watchpoints_.clear();
+    memory_cache_.clear();
+    instruction_cache_.clear();
+    displaced_.clear();
+    scratch_pages_.clear();
+    syscall_instruction_.reset();
+    protected_pages_.clear();
+    if (memory_fd_ != -1) {
+        close(memory_fd_);
+        memory_fd_ = -1;
+    }
+}
+
+std::unique_ptr<sdb::process> sdb::process::fork_parked_copy() {
+    if (state_ != process_state::stopped) {
+        error::send("Process must be stopped to checkpoint");
+    }
+    if (threads_.size() != 1) {
+        error::send("Only single-threaded processes can be checkpointed");
+    }
+
+    auto& thread = threads_.at(current_thread_);
+    // The copy starts out where the syscall ran, so that mustn't be patched
+    // over the code it stopped in
+    if (!syscall_instruction_) {
+        add_scratch_page(thread, get_pc());
+    }
+    thread.regs->flush();
+    user_regs_struct regs;
+    read_gprs(regs, thread.tid);
+
+    // CLONE_PTRACE traces the copy from birth, stopped with a SIGSTOP of
+    // its own, and CLONE_UNTRACED keeps a fork stop from being reported
+    // when forks are followed
+    std::uint64_t flags = SIGCHLD | CLONE_PTRACE | CLONE_UNTRACED;
+    auto result = static_cast<std::int64_t>(
+        inject_syscall(thread, SYS_clone, { flags, 0, 0, 0, 0, 0 }));
+    if (result < 0) {
+        errno = -result;
+        error::send_errno("Could not fork process");
+    }
+
+    stop_reason fork_stop(W_STOPCODE(SIGTRAP));
+    fork_stop.tid = thread.tid;
+    fork_stop.child_pid = static_cast<pid_t>(result);
+    auto copy = adopt_fork_child(fork_stop, /*inherit_breakpoints=*/false);
+    copy->terminate_on_end_ = true;
+    // Back to the registers from before the syscall, which the copy
+    // resumes from as if it had never run
+    copy->write_gprs(regs, copy->pid_);
+    copy->get_registers().invalidate();
+    return copy;
+}
+
+void sdb::process::discard_parked_copy(process& copy) {
+    if (copy.pid_ == 0) return;
+    kill(copy.pid_, SIGKILL);
+    int status;
+    waitpid(copy.pid_, &status, __WALL);
+    copy.threads_.clear();
+    copy.pid_ = 0;
+}
+
+int sdb::process::checkpoint() {
+    // Restarting kills the process, which isn't ours to kill
+    if (!terminate_on_end_) {
+        error::send("Can only checkpoint processes sdb launched");
+    }
+    auto copy = fork_parked_copy();
+    auto id = next_checkpoint_id_++;
+    checkpoints_.emplace_back(id, std::move(copy));
+    return id;
+}
+
+void sdb::process::delete_checkpoint(int id) {
+    auto it = std::find_if(begin(checkpoints_), end(checkpoints_),
+        [&](auto& entry) { return entry.first == id; });
+    if (it == end(checkpoints_)) {
+        error::send("No such checkpoint");
+    }
+    discard_parked_copy(*it->second);
+    checkpoints_.erase(it);
+}
+
+std::vector<sdb::process::checkpoint_info>
+sdb::process::checkpoints() const {
+    std::vector<checkpoint_info> ret;
+    for (auto& [id, copy] : checkpoints_) {
+        ret.push_back({ id, copy->pid(), copy->get_pc() });
+    }
+    return ret;
+}
+
+void sdb::process::restart(int id) {
+    if (!terminate_on_end_) {
+        error::send("Can only restart processes sdb launched");
+    }
+    auto it = std::find_if(begin(checkpoints_), end(checkpoints_),
+        [&](auto& entry) { return entry.first == id; });
+    if (it == end(checkpoints_)) {
+        error::send("No such checkpoint");
+    }
+    auto copy = it->second->fork_parked_copy();
+
+    if (state_ != process_state::exited and
+        state_ != process_state::terminated) {
+        stop_running_threads();
+        kill(pid_, SIGKILL);
+        // The leader is only reported once every other thread is reaped
+        for (auto& [tid, thread] : threads_) {
+            int status;
+            if (tid == pid_) continue;
+            while (waitpid(tid, &status, __WALL) == tid and
+                   WIFSTOPPED(status)) {}
+        }
+        int status;
+        while (waitpid(pid_, &status, __WALL) == pid_ and
+               WIFSTOPPED(status)) {}
+    }
+    {
+        std::lock_guard lock(waits().mutex);
+        drop_parked_statuses();
+    }
+    if (memory_fd_ != -1) {
+        close(memory_fd_);
+        memory_fd_ = -1;
+    }
+    if (pidfd_ != -1) {
+        close(pidfd_);
+        pidfd_ = -1;
+    }
+
+    // Take over the copy's thread, and its scratch pages as of the
+    // checkpoint
+    pid_ = copy->pid_;
+    threads_.clear();
+    add_thread(pid_);
+    current_thread_ = pid_;
+    state_ = process_state::stopped;
+    displaced_ = std::move(copy->displaced_);
+    scratch_pages_ = std::move(copy->scratch_pages_);
+    syscall_instruction_ = copy->syscall_instruction_;
+    memory_cache_.clear();
+    copy->threads_.clear();
+    copy->pid_ = 0;
+
+    // The copy's memory and pages are as the program left them, so put
+    // back every stoppoint we have now. add_thread already gave it our
+    // debug registers
+    breakpoint_sites_.for_each([&](auto& site) {
+        if (site.is_enabled() and !site.is_hardware()) {
+            std::byte int3{ 0xcc };
+            patch_memory(site.address(), { &int3, 1 });
+        }
+    });
+    for (auto& [page, entry] : protected_pages_) {
+        entry.applied = entry.original;
+    }
+    for (auto& [page, entry] : std::map(protected_pages_)) {
+        update_page_protection(page);
+    }
+    watchpoints_.for_each([&](auto& point) {
+        point.update_data();
+    });
+}
+
+std::optional<sdb::stop_reason> sdb::process::wait_for(
+    std::chrono::microseconds timeout)
+{
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() + timeout;
+
+    // waitpid can't time out, so poll with a backoff that starts short
+    // enough for fast stops and stays cheap for long-running ones
+    auto delay = std::chrono::microseconds{ 10 };
+    constexpr auto max_delay = std::chrono::microseconds{ 10'000 };
+    while (true) {
+        if (auto reason = try_wait()) return reason;
+
+        auto now = clock::now();
+        if (now >= deadline) return std::nullopt;
+        std::this_thread::sleep_for(std::min<clock::duration>(
+            delay, deadline - now));
+        delay = std::min(delay * 2, max_delay);
+    }
+}
+
+std::optional<sdb::stop_reason>
+sdb::process::handle_wait_status(pid_t tid, int wait_status) {
+    if (!threads_.count(tid)) {
+        // Threads dropped by an exec still report their exit
+        if (!WIFSTOPPED(wait_status)) return std::nullopt;
+
+        // The first stop of a new thread, which runs along with the rest
+        resume_thread(add_thread(tid));
+        return std::nullopt;
+    }
+    auto& thread = threads_.at(tid);
+    thread.state = process_state::stopped;
+
+    if (!WIFSTOPPED(wait_status) and tid != pid_) {
+        // Only the exit of the whole process is worth reporting
+        threads_.erase(tid);
+        if (current_thread_ == tid) current_thread_ = pid_;
+        return std::nullopt;
+    }
+
+    if (is_attached_ and WIFSTOPPED(wait_status)) {
+        thread.regs->invalidate();
+
+        if (is_clone_stop(wait_status)) {
+            // The new thread is picked up from its own first stop
+            resume_thread(thread);
+            return std::nullopt;
+        }
+        if (thread.pending_interrupt and is_interrupt_stop(wait_status)) {
+            thread.pending_interrupt = false;
+            resume_thread(thread);
+            return std::nullopt;
+        }
+        if (is_seccomp_stop(wait_status) and !syscall_filter_active_) {
+            // Left over from a filter which no longer matches the catch
+            // policy; the policy is enforced by PTRACE_SYSCALL instead
+            resume_thread(thread);
+            return std::nullopt;
+        }
+    }
+
+    // A fault on a page protected for a software watchpoint is rerun as a
+    // step, so that as with a hardware data watchpoint the stop comes
+    // after the access. Fetches from a page whose execution was taken away
+    // stop before the instruction if an execute stoppoint is there
+    bool rerun_fault = false;
+    std::optional<hardware_stoppoint_id> execute_hit;
+    auto fault = is_attached_ ?
+        software_watch_fault(tid, wait_status) : std::nullopt;
+    if (fault and *fault == thread.regs->read_by_id_as<std::uint64_t>(
+        register_id::rip)) {
+        execute_hit = backed_execute_stoppoint(virt_addr{ *fault });
+        if (!execute_hit) {
+            wait_status = step_through_page(
+                thread, *fault & ~std::uint64_t{ 0xfff });
+            rerun_fault = true;
+        }
+    }
+    else if (fault) {
+        wait_status = single_step_thread(thread);
+        rerun_fault = true;
+    }
+
+    stop_reason reason(wait_status);
+    reason.tid = tid;
+
+    auto event = ptrace_event(wait_status);
+    if (is_attached_ and
+        (event == PTRACE_EVENT_FORK or event == PTRACE_EVENT_VFORK)) {
+        current_thread_ = tid;
+        unsigned long child;
+        if (ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &child) < 0) {
+            error::send_errno("Could not get forked process id");
+        }
+        reason.trap_reason = trap_type::fork;
+        reason.child_pid = static_cast<pid_t>(child);
+        reason.shares_memory = event == PTRACE_EVENT_VFORK;
+    }
+    else if (is_attached_ and event == PTRACE_EVENT_EXEC) {
+        reset_after_exec();
+        reason.tid = pid_;
+        reason.trap_reason = trap_type::exec;
+    }
+    else if (is_attached_ and reason.reason == process_state::stopped) {
+        current_thread_ = tid;
+        augment_stop_reason(reason);
+
+        // Execute stoppoints without a debug register stop as software ones
+        if (execute_hit) {
+            hardware_stoppoints_.record_hit(*execute_hit);
+            reason.info = SIGTRAP;
+            reason.trap_reason = execute_hit->index() == 0 ?
+                trap_type::software_break : trap_type::software_watch;
+        }
+
+        auto instr_begin = get_pc() - 1;
+        if (reason.info == SIGTRAP) { 
+            std::optional<breakpoint_site*> hit;
+            if (execute_hit and execute_hit->index() == 0) {
+                hit = &breakpoint_sites_.get_by_id(std::get<0>(*execute_hit));
+            }
+            else if (execute_hit) {
+                auto& point =
+                    watchpoints_.get_by_id(std::get<1>(*execute_hit));
+                if (!should_report_hit(point, tid)) {
+                    step_over_breakpoint(thread);
+                    resume_thread(thread);
+                    return std::nullopt;
+                }
+                reason.watchpoint_id = point.id();
+            }
+            else if (reason.trap_reason == trap_type::software_break and
+                breakpoint_sites_.contains_address(instr_begin) and
+                breakpoint_sites_.get_by_address(instr_begin).is_enabled()) 
+            {
+                set_pc(instr_begin);
+                hit = &breakpoint_sites_.get_by_address(instr_begin);
+            }
+            else if (reason.trap_reason == trap_type::hardware_break) {
+                hardware_hits_.clear();
+                auto steps_over = false;
+                for (auto id : triggered_stoppoints()) {
+                    hardware_stoppoints_.record_hit(id);
+                    auto report = id.index() == 1 ?
+                        should_report_hit(
+                            watchpoints_.get_by_id(std::get<1>(id)), tid) :
+                        should_report_hit(
+                            breakpoint_sites_.get_by_id(std::get<0>(id)), tid);
+                    if (report) hardware_hits_.push_back(id);
+                    if (id.index() == 0) steps_over = true;
+                }
+                if (hardware_hits_.empty()) {
+                    // Data watchpoints trap after the access, so there is
+                    // nothing to step over
+                    if (steps_over) step_over_breakpoint(thread);
+                    resume_thread(thread);
+                    return std::nullopt;
+                }
+            }
+            else if (reason.trap_reason == trap_type::syscall) {
+                if (!reason.syscall_info) {
+                    resume_thread(thread);
+                    return std::nullopt;
+                }
+                auto& info = *reason.syscall_info;
+                auto point = !info.entry and
+                    static_cast<std::int64_t>(info.ret) == -EFAULT and
+                    protects_data() ?
+                    rerun_faulted_syscall(thread, info) : nullptr;
+                if (point) {
+                    reason.trap_reason = trap_type::software_watch;
+                    reason.watchpoint_id = point->id();
+                }
+                else if (!maybe_resume_from_syscall(reason)) {
+                    return std::nullopt;
+                }
+            }
+            else if (reason.trap_reason == trap_type::single_step and
+                     (rerun_fault or !thread.watch_faults.empty())) {
+                auto point = take_software_watch_hit(thread);
+                if (point) {
+                    hardware_stoppoints_.record_hit(hardware_stoppoint_id{
+                        std::in_place_index<1>, point->id() });
+                }
+                if (point and should_report_hit(*point, tid)) {
+                    reason.trap_reason = trap_type::software_watch;
+                    reason.watchpoint_id = point->id();
+                }
+                else if (rerun_fault) {
+                    resume_thread(thread);
+                    return std::nullopt;
+                }
+            }
+
+            // Filtered here rather than by the caller so that a hit which
+            // doesn't count costs only a step over the breakpoint
+            if (hit and !should_report_hit(**hit, tid)) {
+                step_over_breakpoint(thread);
+                resume_thread(thread);
+                return std::nullopt;
+            }
+        }
+    }
+
+    state_ = reason.reason;
+    if (state_ == process_state::stopped and
+        stop_mode_ == stop_mode::all_stop) {
+        stop_running_threads();
+    }
+    return reason;
+}
+
+void sdb::process::stop_running_threads() {
+    std::vector<pid_t> stopping;
+    for (auto& [tid, thread] : threads_) {
+        if (thread.state == process_state::running) {
+            // Seized threads can be stopped without sending them a signal
+            if (seized_) {
+                ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+            }
+            else {
+                syscall(SYS_tgkill, pid_, tid, SIGSTOP);
+            }
+            stopping.push_back(tid);
+        }
+    }
+
+    for (auto tid : stopping) {
+        auto wait_status = wait_for_thread(tid);
+        auto& thread = threads_.at(tid);
+        thread.state = process_state::stopped;
+        if (!WIFSTOPPED(wait_status)) {
+            // The exit of the whole process still has to be reported
+            if (tid == pid_) {
+                thread.pending_status = wait_status;
+                continue;
+            }
+            threads_.erase(tid);
+            if (current_thread_ == tid) current_thread_ = pid_;
+            continue;
+        }
+
+        thread.regs->invalidate();
+        if (!is_interrupt_stop(wait_status)) {
+            // The thread stopped for something else first; report that
+            // later, and swallow our interrupt once it turns up
+            thread.pending_status = wait_status;
+            thread.pending_interrupt = true;
+        }
+    }
+}
+
+bool sdb::process::is_interrupt_stop(int wait_status) const {
+    if (seized_) {
+        return ptrace_event(wait_status) == PTRACE_EVENT_STOP;
+    }
+    return is_sigstop(wait_status);
+}
+
+void sdb::process::interrupt() {
+    if (state_ != process_state::running) return;
+    stop_running_threads();
+    state_ = process_state::stopped;
+}
+
+int sdb::process::pidfd() {
+    if (pidfd_ == -1) {
+        pidfd_ = static_cast<int>(syscall(SYS_pidfd_open, pid_, 0));
+        if (pidfd_ == -1) {
+            error::send_errno("Could not open pidfd");
+        }
+    }
+    return pidfd_;
+}
+
+void sdb::process::resume(int signal) {
+    if (stop_mode_ == stop_mode::all_stop) {
+        resume_all_threads(signal);
+        return;
+    }
+
+    auto& thread = threads_.at(current_thread_);
+    if (thread.state == process_state::stopped) {
+        sync_debug_registers();
+        step_over_breakpoint(thread);
+        resume_thread(thread, signal);
+    }
+    state_ = process_state::running;
+}
+
+void sdb::process::resume_all_threads(int signal) {
+    memory_cache_.clear();
+
+    // A stop collected from another thread is reported before anything
+    // runs again
+    auto has_pending = std::any_of(begin(threads_), end(threads_),
+        [](auto& entry) { return entry.second.pending_status.has_value(); });
+    if (!has_pending) {
+        sync_debug_registers();
+
+        // Step every thread off its breakpoint before any of them runs, so
+        // none can slip past a site while it is lifted
+        for (auto& [tid, thread] : threads_) {
+            if (thread.state == process_state::stopped) {
+                step_over_breakpoint(thread);
+            }
+        }
+        for (auto& [tid, thread] : threads_) {
+            if (thread.state == process_state::stopped) {
+                resume_thread(thread, tid == current_thread_ ? signal : 0);
+            }
+        }
+    }
+    state_ = process_state::running;
+}
+
+bool sdb::process::should_report_hit(breakpoint_site& site, pid_t tid) {
+    if (auto& condition = site.condition()) {
+        try {
+            if (!condition->evaluate(*this, tid)) return false;
+        }
+        catch (const error&) {}
+    }
+
+    ++site.hit_count_;
+    if (site.ignore_count_ > 0) {
+        --site.ignore_count_;
+        return false;
+    }
+    if (site.is_tracepoint()) {
+        record_tracepoint_hit(site, tid);
+        return false;
+    }
+    return true;
+}
+
+void sdb::process::record_tracepoint_hit(
+    const breakpoint_site& site, pid_t tid) {
+    using namespace std::chrono;
+    auto& captures = site.get_trace_action()->captures;
+
+    tracepoint_hit hit{ site.id(), tid, static_cast<std::uint64_t>(
+        duration_cast<nanoseconds>(
+            steady_clock::now().time_since_epoch()).count()), {} };
+    hit.values.reserve(captures.size());
+    for (auto& capture : captures) {
+        try {
+            hit.values.push_back(capture.evaluate(*this, tid));
+        }
+        catch (const error&) {
+            hit.values.push_back(std::nullopt);
+        }
+    }
+    tracepoint_hits_.push(std::move(hit));
+}
+
+bool sdb::process::should_report_hit(watchpoint& point, pid_t tid) {
+    using namespace std::chrono;
+    auto rip = threads_.at(tid).regs->read_by_id_as<std::uint64_t>(
+        register_id::rip);
+    point.history_.push({ rip, static_cast<std::uint64_t>(
+        duration_cast<nanoseconds>(
+            steady_clock::now().time_since_epoch()).count()),
+        point.previous_data(), point.data() });
+
+    ++point.hit_count_;
+    if (point.ignore_count_ > 0) {
+        --point.ignore_count_;
+        return false;
+    }
+    return !point.auto_continue_;
+}
+
+std::optional<int> sdb::process::step_over_breakpoint(thread_state& thread) {
+    auto pc = virt_addr{
+        thread.regs->read_by_id_as<std::uint64_t>(register_id::rip) };
+    if (!breakpoint_sites_.enabled_stoppoint_at_address(pc)) {
+        // Unlike a debug register, a page without execute permission
+        // faults again when the thread resumes, so the instruction is run
+        // in a step which unprotects it
+        if (!backed_execute_stoppoint(pc)) return std::nullopt;
+        thread.regs->flush();
+        return single_step_thread(thread);
+    }
+
+    auto& bp = breakpoint_sites_.get_by_address(pc);
+    thread.regs->flush();
+    if (bp.is_hardware()) {
+        // The kernel sets the resume flag after a debug register hit, so
+        // the breakpoint doesn't trigger again in the step
+        return single_step_thread(thread);
+    }
+
+    if (auto wait_status = displaced_step(thread, pc)) {
+        return wait_status;
+    }
+
+    // The original byte is already known, so lifting and rearming the int3
+    // is one write each, without enable() reading the page back in
+    std::byte int3{ 0xcc };
+    patch_memory(pc, { &bp.saved_data_, 1 });
+    auto wait_status = single_step_thread(thread);
+    patch_memory(pc, { &int3, 1 });
+    return wait_status;
+}
+
+std::optional<int> sdb::process::displaced_step(
+    thread_state& thread, virt_addr pc)
+{
+    auto displaced = displaced_copy(thread, pc);
+    if (!displaced) return std::nullopt;
+    auto& [copy, info] = *displaced;
+
+    auto& regs = *thread.regs;
+    regs.write_by_id(register_id::rip, copy.addr());
+    regs.flush();
+    auto wait_status = single_step_thread(thread);
+    if (!WIFSTOPPED(wait_status)) return wait_status;
+
+    // A signal which arrived first stops the thread before the copy runs
+    auto rip = regs.read_by_id_as<std::uint64_t>(register_id::rip);
+    if (rip == copy.addr()) {
+        regs.write_by_id(register_id::rip, pc.addr());
+        regs.flush();
+        return wait_status;
+    }
+
+    if (info.relative_rip) {
+        rip = rip - copy.addr() + pc.addr();
+        regs.write_by_id(register_id::rip, rip);
+    }
+    if (info.pushes_return_address) {
+        auto rsp = regs.read_by_id_as<std::uint64_t>(register_id::rsp);
+        auto return_address = pc.addr() + info.length;
+        write_memory(virt_addr{ rsp }, { as_bytes(return_address), 8 });
+    }
+    regs.flush();
+    return wait_status;
+}
+
+const sdb::process::displaced_instruction* sdb::process::displaced_copy(
+    thread_state& thread, virt_addr pc)
+{
+    if (auto it = displaced_.find(pc.addr()); it != end(displaced_)) {
+        return it->second ? &*it->second : nullptr;
+    }
+
+    auto& entry = displaced_[pc.addr()];
+    disassembler disas(*this);
+    auto info = disas.relocation(pc);
+    if (!info) return nullptr;
+    auto slot = allocate_scratch_slot(thread, pc);
+    if (!slot) return nullptr;
+
+    auto code = read_memory_without_traps(pc, info->length);
+    if (auto offset = info->rip_displacement_offset) {
+        // The operand has to point where it did from the original address
+        auto displacement = from_bytes<std::int32_t>(code.data() + *offset);
+        auto adjusted = displacement +
+            static_cast<std::int64_t>(pc.addr() - slot->addr());
+        if (adjusted < std::numeric_limits<std::int32_t>::min() or
+            adjusted > std::numeric_limits<std::int32_t>::max()) {
+            return nullptr;
+        }
+        displacement = static_cast<std::int32_t>(adjusted);
+        std::copy(as_bytes(displacement), as_bytes(displacement) + 4,
+            code.begin() + *offset);
+    }
+    patch_memory(*slot, { code.data(), code.size() });
+    entry = displaced_instruction{ *slot, *info };
+    return &*entry;
+}
+
+namespace {
+    constexpr std::size_t scratch_page_size = 0x1000;
+    constexpr std::size_t scratch_slot_size = 16;
+    // rel32 operands reach 2GiB either way, less the page itself
+    constexpr std::uint64_t scratch_reach = 0x7fff0000;
+}
+
+std::optional<sdb::virt_addr> sdb::process::allocate_scratch_slot(
+    thread_state& thread, virt_addr near)
+{
+    auto reachable = [&](virt_addr page) {
+        auto distance = page > near ?
+            page.addr() - near.addr() : near.addr() - page.addr();
+        return distance < scratch_reach;
+    };
+
+    for (auto& [page, used] : scratch_pages_) {
+        if (used < scratch_page_size / scratch_slot_size and
+            reachable(page)) {
+            return page + scratch_slot_size * used++;
         }
     }
+
+    auto& [page, used] = add_scratch_page(thread, near);
+    if (!reachable(page)) return std::nullopt;
+    return page + scratch_slot_size * used++;
 }
 
-sdb::stop_reason::stop_reason(int wait_status) {
-    if (WIFEXITED(wait_status)) {
-        reason = process_state::exited;
-        info = WEXITSTATUS(wait_status);
-    } else if (WIFSIGNALED(wait_status)) {
-        reason = process_state::terminated;
-        info = WTERMSIG(wait_status);
-    } else if (WIFSTOPPED(wait_status)) {
-        reason = process_state::stopped;
-        info = WSTOPSIG(wait_status);
+std::pair<sdb::virt_addr, std::size_t>& sdb::process::add_scratch_page(
+    thread_state& thread, virt_addr near)
+{
+    auto page = map_scratch_page(thread, near);
+    auto& entry = scratch_pages_.emplace_back(page, 0);
+    // Later syscalls run from the first slot of the first page rather than
+    // patching the code a thread stopped in
+    if (!syscall_instruction_) {
+        std::array<std::byte, 2> syscall_bytes{
+            std::byte{ 0x0f }, std::byte{ 0x05 } };
+        patch_memory(page, { syscall_bytes.data(), 2 });
+        syscall_instruction_ = page;
+        ++entry.second;
     }
+    return entry;
 }
 
-sdb::stop_reason sdb::process::wait_on_signal() {
-    int wait_status;
-    int options = 0;
-    if (waitpid(pid_, &wait_status, options) < 0) {
-        error::send_errno("waitpid failed");
+sdb::virt_addr sdb::process::map_scratch_page(
+    thread_state& thread, virt_addr near)
+{
+    auto is_error = [](std::uint64_t result) {
+        return result > static_cast<std::uint64_t>(-4096);
+    };
+    auto map = [&](std::uint64_t hint, std::uint64_t flags) {
+        return inject_syscall(thread, SYS_mmap, { hint, scratch_page_size,
+            PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | flags,
+            static_cast<std::uint64_t>(-1), 0 });
+    };
+
+    // Walk down from the code until a free spot turns up, so that
+    // RIP-relative operands can reach the page. MAP_FIXED_NOREPLACE fails
+    // rather than placing it elsewhere
+    auto base = near.addr() & ~(scratch_page_size - 1);
+    for (std::uint64_t step = 0x100000; step <= 0x1000000 and step < base;
+        step += 0x100000) {
+        auto result = map(base - step, MAP_FIXED_NOREPLACE);
+        if (!is_error(result)) return virt_addr{ result };
     }
-    stop_reason reason(wait_status);
-    state_ = reason.reason;
 
-    if (is_attached_ and state_ == process_state::stopped) {
-        read_all_registers();
-        augment_stop_reason(reason);
+    auto result = map(0, 0);
+    if (is_error(result)) {
+        error::send("Could not map scratch page");
+    }
+    return virt_addr{ result };
+}
 
-        auto instr_begin = get_pc() - 1;
-        if (reason.info == SIGTRAP) { 
-            if (reason.trap_reason == trap_type::software_break and
-                breakpoint_sites_.contains_address(instr_begin) and
-                breakpoint_sites_.get_by_address(instr_begin).is_enabled()) 
-            {
-                set_pc(instr_begin);
-            }
-            else if (reason.trap_reason == trap_type::hardware_break) {
-                auto id = get_current_hardware_stoppoint();
-                if (id.index() == 1) {
-                    watchpoints_.get_by_id(std::get<1>(id)).update_data();
-                }
-            }
-            else if (reason.trap_reason == trap_type::syscall) {
-                reason = maybe_resume_from_syscall(reason);
-            }
-        }
+std::uint64_t sdb::process::inject_syscall(thread_state& thread,
+    long number, const std::array<std::uint64_t, 6>& args)
+{
+    thread.regs->flush();
+    user_regs_struct saved;
+    read_gprs(saved, thread.tid);
+    // The stop is reported as if nothing ran, so its signal info has to
+    // survive the step
+    siginfo_t saved_info;
+    if (ptrace(PTRACE_GETSIGINFO, thread.tid, nullptr, &saved_info) < 0) {
+        error::send_errno("Failed to get signal info");
     }
 
-    return reason;
-}
+    auto regs = saved;
+    regs.rax = number;
+    regs.rdi = args[0];
+    regs.rsi = args[1];
+    regs.rdx = args[2];
+    regs.r10 = args[3];
+    regs.r8 = args[4];
+    regs.r9 = args[5];
+    // A thread stopped in an interrupted syscall mustn't restart it
+    regs.orig_rax = -1;
+
+    // Until there is a scratch page, the syscall instruction is patched
+    // over the code the thread stopped in
+    std::optional<std::vector<std::byte>> patched;
+    auto address = syscall_instruction_.value_or(virt_addr{ saved.rip });
+    if (!syscall_instruction_) {
+        patched = read_memory(address, 2);
+        std::array<std::byte, 2> syscall_bytes{
+            std::byte{ 0x0f }, std::byte{ 0x05 } };
+        patch_memory(address, { syscall_bytes.data(), 2 });
+    }
+    regs.rip = address.addr();
+    write_gprs(regs, thread.tid);
 
-void sdb::process::resume() {
-    auto pc = get_pc();
-    if (breakpoint_sites_.enabled_stoppoint_at_address(pc)) {
-        auto& bp = breakpoint_sites_.get_by_address(pc);
-        bp.disable();
-        if (ptrace(PTRACE_SINGLESTEP, pid_, nullptr, nullptr) < 0) {
-            error::send_errno("Failed to single step");
-        }
-        int wait_status;
-        if (waitpid(pid_, &wait_status, 0) < 0) {
-            error::send_errno("waitpid failed");
-        }
-        bp.enable();
+    int wait_status;
+    do {
+        wait_status = single_step_thread(thread);
+    } while (is_seccomp_stop(wait_status));
+    if (patched) {
+        patch_memory(address, { patched->data(), patched->size() });
+    }
+    if (!WIFSTOPPED(wait_status)) {
+        error::send("Process ended during injected syscall");
     }
 
-    auto request = 
-        syscall_catch_policy_.get_mode() == syscall_catch_policy::mode::none 
-        ? PTRACE_CONT : PTRACE_SYSCALL;
-    if (ptrace(request, pid_, nullptr, nullptr) < 0) {
-        error::send_errno("Could not resume");
+    read_gprs(regs, thread.tid);
+    write_gprs(saved, thread.tid);
+    if (ptrace(PTRACE_SETSIGINFO, thread.tid, nullptr, &saved_info) < 0) {
+        error::send_errno("Failed to set signal info");
     }
-    state_ = process_state::running;
+    thread.regs->invalidate();
+    if (regs.rip != address.addr() + 2) {
+        error::send("Could not run injected syscall");
+    }
+    return regs.rax;
 }
 
-void sdb::process::read_all_registers() {
-    if (ptrace(PTRACE_GETREGS, pid_, nullptr, &get_registers().data_.regs) < 0) {
-        error::send_errno("Could not read GPR registers");
+void sdb::process::resume_thread(thread_state& thread, int signal) {
+    thread.regs->flush();
+    memory_cache_.clear();
+    thread.watch_faults.clear();
+
+    auto request = PTRACE_SYSCALL;
+    if (syscall_catch_policy_.get_mode() == syscall_catch_policy::mode::none) {
+        request = PTRACE_CONT;
     }
-    if (ptrace(PTRACE_GETFPREGS, pid_, nullptr, &get_registers().data_.i387) < 0) {
-        error::send_errno("Could not read FPR registers");
+    else if (syscall_filter_active_ and !thread.expecting_syscall_exit) {
+        // Entries are reported by the seccomp filter, so we only need to
+        // trace syscalls after one of them has been caught
+        request = PTRACE_CONT;
+    }
+    // Syscalls which fault on a protected page are caught at their exit
+    if (protects_data()) {
+        request = PTRACE_SYSCALL;
+    }
+    if (ptrace(request, thread.tid, nullptr, signal) < 0) {
+        error::send_errno("Could not resume");
     }
-    for (int i = 0; i < 8; ++i) {
-        //read debug registers
-        auto id = static_cast<int>(register_id::dr0) + i;
-        auto info = register_info_by_id(static_cast<register_id>(id));
+    thread.state = process_state::running;
+}
 
-        errno = 0;
-        std::int64_t data = ptrace(PTRACE_PEEKUSER, pid_, info.offset, nullptr);
-        if (errno != 0) error::send_errno("Could not read debug register");
+void sdb::process::read_fprs(user_fpregs_struct& fprs, pid_t tid) const {
+    if (ptrace(PTRACE_GETFPREGS, tid, nullptr, &fprs) < 0) {
+        error::send_errno("Could not read FPR registers");
+    }
+}
 
-        get_registers().data_.u_debugreg[i] = data;
+void sdb::process::read_gprs(user_regs_struct& gprs, pid_t tid) const {
+    if (ptrace(PTRACE_GETREGS, tid, nullptr, &gprs) < 0) {
+        error::send_errno("Could not read GPR registers");
     }
 }
 
-void sdb::process::write_fprs(const user_fpregs_struct& fprs) {
-    if (ptrace(PTRACE_SETFPREGS, pid_, nullptr, &fprs) < 0) {
+std::uint64_t sdb::process::read_user_area(
+    std::size_t offset, pid_t tid) const {
+    errno = 0;
+    std::uint64_t data = ptrace(PTRACE_PEEKUSER, tid, offset, nullptr);
+    if (errno != 0) error::send_errno("Could not read from user area");
+    return data;
+}
+
+void sdb::process::write_fprs(const user_fpregs_struct& fprs, pid_t tid) {
+    if (ptrace(PTRACE_SETFPREGS, tid, nullptr, &fprs) < 0) {
         error::send_errno("Could not write floating point registers");
     }
 }
 
-void sdb::process::write_gprs(const user_regs_struct& gprs) {
-    if (ptrace(PTRACE_SETREGS, pid_, nullptr, &gprs) < 0) {
+void sdb::process::write_gprs(const user_regs_struct& gprs, pid_t tid) {
+    if (ptrace(PTRACE_SETREGS, tid, nullptr, &gprs) < 0) {
         error::send_errno("Could not write general purpose registers");
     }
 }
 
-void sdb::process::write_user_area(std::size_t offset, std::uint64_t data) {
-    if (ptrace(PTRACE_POKEUSER, pid_, offset, data) < 0) {
+void sdb::process::write_user_area(
+    std::size_t offset, std::uint64_t data, pid_t tid) {
+    if (ptrace(PTRACE_POKEUSER, tid, offset, data) < 0) {
         error::send_errno("Could not write to user area");
     }
 }
@@ -290,6 +1889,71 @@ sdb::breakpoint_site& sdb::process::create_breakpoint_site(
         new breakpoint_site(*this, address, hardware, internal)));
 }
 
+std::vector<sdb::breakpoint_site*> sdb::process::create_breakpoint_sites(
+    span<const virt_addr> addresses, bool internal)
+{
+    std::vector<breakpoint_site*> sites;
+    sites.reserve(addresses.size());
+    breakpoint_sites_.reserve(breakpoint_sites_.size() + addresses.size());
+    for (auto address : addresses) {
+        sites.push_back(&create_breakpoint_site(address, false, internal));
+    }
+    return sites;
+}
+
+void sdb::process::enable_breakpoint_sites(
+    span<breakpoint_site* const> sites)
+{
+    std::vector<breakpoint_site*> to_patch;
+    for (auto site : sites) {
+        if (site->is_enabled()) continue;
+        if (site->is_hardware()) {
+            site->enable();
+        }
+        else {
+            to_patch.push_back(site);
+        }
+    }
+
+    std::sort(begin(to_patch), end(to_patch), [](auto lhs, auto rhs) {
+        return lhs->address() < rhs->address();
+    });
+
+    auto page_of = [](breakpoint_site* site) {
+        return site->address().addr() & ~0xfff;
+    };
+
+    auto first = begin(to_patch);
+    while (first != end(to_patch)) {
+        auto page = page_of(*first);
+        auto last = std::find_if(first, end(to_patch),
+            [&](auto site) { return page_of(site) != page; });
+
+        auto low = (*first)->address();
+        auto high = (*(last - 1))->address() + 1;
+        auto memory = read_memory(low, high.addr() - low.addr());
+
+        for (auto it = first; it != last; ++it) {
+            auto offset = (*it)->address().addr() - low.addr();
+            (*it)->saved_data_ = memory[offset];
+            memory[offset] = std::byte{ 0xcc };
+        }
+        patch_memory(low, { memory.data(), memory.size() });
+
+        for (auto it = first; it != last; ++it) {
+            (*it)->is_enabled_ = true;
+        }
+        first = last;
+    }
+}
+
+void sdb::process::enable_all_breakpoint_sites() {
+    std::vector<breakpoint_site*> sites;
+    sites.reserve(breakpoint_sites_.size());
+    breakpoint_sites_.for_each([&](auto& site) { sites.push_back(&site); });
+    enable_breakpoint_sites(sites);
+}
+
 sdb::watchpoint&
 sdb::process::create_watchpoint(
     virt_addr address, 
@@ -306,7 +1970,108 @@ sdb::process::create_watchpoint(
 
 std::vector<std::byte> 
 sdb::process::read_memory(virt_addr address, std::size_t amount) const {
+    // Memory can only be cached while nothing else is changing it
+    if (!is_attached_ or state_ != process_state::stopped or
+        stop_mode_ == stop_mode::non_stop) {
+        return read_memory_uncached(address, amount);
+    }
+
+    auto low = address.addr();
+    auto high = low + amount;
+    auto first_page = low & ~0xfff;
+
+    std::vector<std::uint64_t> missing;
+    for (auto page = first_page; page < high; page += 0x1000) {
+        if (memory_cache_.count(page)) {
+            ++memory_cache_hits_;
+        }
+        else {
+            ++memory_cache_misses_;
+            missing.push_back(page);
+        }
+    }
+    cache_pages(missing);
+
+    // errno isn't meaningful here: the fallback through /proc/pid/mem stops
+    // on short reads which don't set it
+    if (amount > 0 and !memory_cache_.count(first_page)) {
+        error::send("Could not read process memory at address " +
+            std::to_string(address.addr()));
+    }
+
+    // Like process_vm_readv, anything past the first unreadable page is
+    // left zeroed rather than failing the whole read
+    std::vector<std::byte> ret(amount);
+    for (auto page = first_page; page < high; page += 0x1000) {
+        auto it = memory_cache_.find(page);
+        if (it == end(memory_cache_)) break;
+
+        auto copy_low = std::max(page, low);
+        auto copy_high = std::min(page + 0x1000, high);
+        std::copy(it->second.data() + (copy_low - page),
+            it->second.data() + (copy_high - page),
+            ret.data() + (copy_low - low));
+    }
+    return ret;
+}
+
+void sdb::process::cache_pages(const std::vector<std::uint64_t>& pages) const {
+    constexpr std::size_t max_iovecs = 1024;
+
+    std::vector<memory_page> buffer(std::min(pages.size(), max_iovecs));
+    for (std::size_t first = 0; first < pages.size(); first += max_iovecs) {
+        auto count = std::min(max_iovecs, pages.size() - first);
+
+        iovec local_desc{ buffer.data(), count * sizeof(memory_page) };
+        std::vector<iovec> remote_descs;
+        for (std::size_t i = first; i < first + count; ++i) {
+            remote_descs.push_back({ reinterpret_cast<void*>(pages[i]),
+                sizeof(memory_page) });
+        }
+
+        auto result = process_vm_readv(pid_, &local_desc, /*liovcnt=*/1,
+            remote_descs.data(), /*riovcnt=*/count, /*flags=*/0);
+        if (result < 0) break;
+
+        // Partial reads stop at the first page which couldn't be read
+        auto pages_read = result / sizeof(memory_page);
+        for (std::size_t i = 0; i < pages_read; ++i) {
+            memory_cache_[pages[first + i]] = buffer[i];
+        }
+        if (pages_read < count) break;
+    }
+
+    // Pages from there on may only be protected, which the file ignores
+    for (auto page : pages) {
+        if (memory_cache_.count(page)) continue;
+        memory_page data;
+        if (!read_memory_through_file(virt_addr{ page }, data.data(),
+            data.size())) return;
+        memory_cache_[page] = data;
+    }
+}
+
+void sdb::process::update_memory_cache(
+    virt_addr address, span<const std::byte> data)
+{
+    auto low = address.addr();
+    auto high = low + data.size();
+    for (auto page = low & ~0xfff; page < high; page += 0x1000) {
+        auto it = memory_cache_.find(page);
+        if (it == end(memory_cache_)) continue;
+
+        auto copy_low = std::max(page, low);
+        auto copy_high = std::min(page + 0x1000, high);
+        std::copy(data.begin() + (copy_low - low),
+            data.begin() + (copy_high - low),
+            it->second.data() + (copy_low - page));
+    }
+}
+
+std::vector<std::byte> sdb::process::read_memory_uncached(
+    virt_addr address, std::size_t amount) const {
     std::vector<std::byte> ret(amount);
+    auto start = address;
 
     iovec local_desc{ ret.data(), ret.size() };
     std::vector<iovec> remote_descs;
@@ -320,8 +2085,10 @@ sdb::process::read_memory(virt_addr address, std::size_t amount) const {
     }
 
     if (process_vm_readv(pid_, &local_desc, /*liovcnt=*/1,
-        remote_descs.data(), /*riovcnt=*/remote_descs.size(), /*flags=*/0) < 0) {
-        error::send_errno("Could not read process memory");
+        remote_descs.data(), /*riovcnt=*/remote_descs.size(), /*flags=*/0) < 0
+        and !read_memory_through_file(start, ret.data(), ret.size())) {
+        error::send("Could not read process memory at address " +
+            std::to_string(start.addr()));
     }
     return ret;
 }
@@ -341,98 +2108,463 @@ std::vector<std::byte> sdb::process::read_memory_without_traps(
 
 void sdb::process::write_memory(
     virt_addr address, span<const std::byte> data) {
+    patch_memory(address, data);
+    instruction_cache_.invalidate(address, data.size());
+
+    // Copies of instructions overlapping the write are stale
+    auto low = address.addr() - instruction_cache::max_instruction_length;
+    auto high = address.addr() + data.size();
+    for (auto it = begin(displaced_); it != end(displaced_);) {
+        if (it->first > low and it->first < high) {
+            it = displaced_.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void sdb::process::patch_memory(
+    virt_addr address, span<const std::byte> data) {
+    if (!write_memory_through_file(address, data)) {
+        write_memory_with_ptrace(address, data);
+    }
+    update_memory_cache(address, data);
+}
+
+int sdb::process::memory_fd() const {
+    if (memory_fd_ == -1) {
+        auto path = "/proc/" + std::to_string(pid_) + "/mem";
+        memory_fd_ = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    }
+    return memory_fd_;
+}
+
+bool sdb::process::write_memory_through_file(
+    virt_addr address, span<const std::byte> data)
+{
+    // Writes through /proc/<pid>/mem bypass page protections just like
+    // PTRACE_POKEDATA, unless the kernel was booted to forbid that
+    auto fd = memory_fd();
+    if (fd < 0) return false;
+
     std::size_t written = 0;
     while (written < data.size()) {
-        auto remaining = data.size() - written;
+        auto result = pwrite(fd, data.begin() + written,
+            data.size() - written, address.addr() + written);
+        if (result < 0 and errno == EINTR) continue;
+        if (result <= 0) return false;
+        written += result;
+    }
+    return true;
+}
+
+bool sdb::process::read_memory_through_file(
+    virt_addr address, std::byte* data, std::size_t amount) const
+{
+    auto fd = memory_fd();
+    if (fd < 0) return false;
+
+    std::size_t read = 0;
+    while (read < amount) {
+        auto result = pread(fd, data + read, amount - read,
+            address.addr() + read);
+        if (result < 0 and errno == EINTR) continue;
+        if (result <= 0) return false;
+        read += result;
+    }
+    return true;
+}
+
+void sdb::process::write_memory_with_ptrace(
+    virt_addr address, span<const std::byte> data)
+{
+    // Aligned words never straddle a page boundary, so patching the partial
+    // words at either end can't fault on a neighbouring page
+    auto end = address.addr() + data.size();
+    for (auto word_address = address.addr() & ~0b111;
+        word_address < end; word_address += 8) {
+        auto low = std::max(word_address, address.addr());
+        auto high = std::min(word_address + 8, end);
+
         std::uint64_t word;
-        if (remaining >= 8) {
-            word = from_bytes<std::uint64_t>(data.begin() + written);
-        }
-        else {
-            auto read = read_memory(address + written, 8);
-            auto word_data = reinterpret_cast<char*>(&word);
-            std::memcpy(word_data, data.begin() + written, remaining);
-            std::memcpy(word_data + remaining, read.data() + remaining, 8 - remaining);
+        if (high - low < 8) {
+            errno = 0;
+            word = ptrace(
+                PTRACE_PEEKDATA, current_thread_, word_address, nullptr);
+            if (errno != 0) {
+                error::send_errno("Failed to write memory");
+            }
         }
-        if (ptrace(PTRACE_POKEDATA, pid_, address + written, word) < 0) {
+        std::memcpy(as_bytes(word) + (low - word_address),
+            data.begin() + (low - address.addr()), high - low);
+
+        if (ptrace(PTRACE_POKEDATA, current_thread_, word_address, word) < 0) {
             error::send_errno("Failed to write memory");
         }
-        written += 8;
     }
 }
 
-int sdb::process::set_hardware_breakpoint(
+void sdb::process::set_hardware_breakpoint(
     breakpoint_site::id_type id, virt_addr address)
 {
-    return set_hardware_stoppoint(address, stoppoint_mode::execute, 1);
+    hardware_stoppoints_.add({ hardware_stoppoint_id{
+        std::in_place_index<0>, id }, address, stoppoint_mode::execute, 1 });
+}
+
+void sdb::process::clear_hardware_stoppoint(hardware_stoppoint_id id) {
+    hardware_stoppoints_.remove(id);
+}
+
+void sdb::process::sync_debug_registers() {
+    hardware_stoppoints_.assign();
+
+    // Stoppoints which lost their register are caught on their pages
+    // instead, and those which gained one no longer need to be
+    auto wanted = hardware_stoppoints_.non_resident();
+    for (auto it = begin(backed_stoppoints_); it != end(backed_stoppoints_);) {
+        if (std::find(begin(wanted), end(wanted), *it) == end(wanted)) {
+            clear_software_watchpoint(it->address, it->mode, it->size);
+            it = backed_stoppoints_.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    for (auto& request : wanted) {
+        if (std::find(begin(backed_stoppoints_), end(backed_stoppoints_),
+            request) == end(backed_stoppoints_)) {
+            set_software_watchpoint(
+                request.address, request.mode, request.size);
+            backed_stoppoints_.push_back(request);
+        }
+    }
+
+    auto values = debug_registers_;
+    values[7] = 0;
+    auto& slots = hardware_stoppoints_.slots();
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        values[i] = 0;
+        if (!slots[i]) continue;
+
+        values[i] = slots[i]->address.addr();
+        auto mode_flag = encode_hardware_stoppoint_mode(slots[i]->mode);
+        auto size_flag = encode_hardware_stoppoint_size(slots[i]->size);
+        values[7] |= (std::uint64_t{ 1 } << (i * 2)) |
+            (mode_flag << (i * 4 + 16)) | (size_flag << (i * 4 + 18));
+    }
+
+    // The kernel checks an address against the size dr7 gives its
+    // register, so registers which change are switched off first. The
+    // rest is written in one go when each thread resumes
+    std::uint64_t moved = 0;
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        auto mask = stoppoint_control_mask(i);
+        auto enabled = debug_registers_[7] & (std::uint64_t{ 0b11 } << (i * 2));
+        if (enabled and (values[i] != debug_registers_[i] or
+            (values[7] & mask) != (debug_registers_[7] & mask))) {
+            moved |= mask;
+        }
+    }
+    if (moved) {
+        debug_registers_[7] &= ~moved;
+        for (auto& [tid, thread] : threads_) {
+            if (thread.state != process_state::stopped) continue;
+            thread.regs->write_by_id(register_id::dr7, debug_registers_[7]);
+            thread.regs->flush();
+        }
+    }
+
+    for (auto i : { 0, 1, 2, 3, 7 }) {
+        if (values[i] != debug_registers_[i]) {
+            write_debug_register(i, values[i]);
+        }
+    }
+}
+
+std::optional<sdb::hardware_stoppoint_id>
+sdb::process::backed_execute_stoppoint(virt_addr address) const {
+    for (auto& request : backed_stoppoints_) {
+        if (request.mode == stoppoint_mode::execute and
+            request.address == address) {
+            return request.owner;
+        }
+    }
+    return std::nullopt;
+}
+
+void sdb::process::write_debug_register(int index, std::uint64_t value) {
+    debug_registers_[index] = value;
+    auto id = static_cast<register_id>(
+        static_cast<int>(register_id::dr0) + index);
+    for (auto& [tid, thread] : threads_) {
+        thread.regs->write_by_id(id, value);
+    }
+}
+
+bool sdb::process::set_watchpoint(
+    watchpoint::id_type id, virt_addr address,
+    stoppoint_mode mode, std::size_t size)
+{
+    auto fits_register = (size == 1 or size == 2 or size == 4 or size == 8)
+        and (address.addr() & (size - 1)) == 0;
+    if (mode == stoppoint_mode::execute and size != 1) {
+        error::send("Execute watchpoints must be one byte");
+    }
+    if (fits_register) {
+        hardware_stoppoints_.add({ hardware_stoppoint_id{
+            std::in_place_index<1>, id }, address, mode, size });
+        return true;
+    }
+
+    set_software_watchpoint(address, mode, size);
+    return false;
 }
 
-int sdb::process::set_hardware_stoppoint(
+void sdb::process::set_software_watchpoint(
     virt_addr address, stoppoint_mode mode, std::size_t size)
 {
-    auto& regs = get_registers();
-    auto control = regs.read_by_id_as<std::uint64_t>(register_id::dr7);
+    auto end = address.addr() + size;
+    for (auto page = address.addr() & ~0xfff; page < end; page += 0x1000) {
+        auto [it, inserted] = protected_pages_.try_emplace(page);
+        if (inserted) {
+            it->second.original = it->second.applied = page_protection(page);
+        }
+        switch (mode) {
+            case stoppoint_mode::read_write: ++it->second.accesses; break;
+            case stoppoint_mode::write: ++it->second.writes; break;
+            case stoppoint_mode::execute: ++it->second.executes; break;
+        }
+        update_page_protection(page);
+    }
+}
 
-    int free_space = find_free_stoppoint_register(control);
+void sdb::process::clear_software_watchpoint(
+    virt_addr address, stoppoint_mode mode, std::size_t size)
+{
+    auto end = address.addr() + size;
+    for (auto page = address.addr() & ~0xfff; page < end; page += 0x1000) {
+        auto& entry = protected_pages_.at(page);
+        switch (mode) {
+            case stoppoint_mode::read_write: --entry.accesses; break;
+            case stoppoint_mode::write: --entry.writes; break;
+            case stoppoint_mode::execute: --entry.executes; break;
+        }
+        update_page_protection(page);
+    }
+}
 
-    auto id = static_cast<int>(register_id::dr0) + free_space;
-    regs.write_by_id(static_cast<register_id>(id), address.addr());
+bool sdb::process::protects_data() const {
+    return std::any_of(begin(protected_pages_), end(protected_pages_),
+        [](auto& entry) {
+            return entry.second.writes > 0 or entry.second.accesses > 0;
+        });
+}
 
-    auto mode_flag = encode_hardware_stoppoint_mode(mode);
-    auto size_flag = encode_hardware_stoppoint_size(size);
-    
-    auto enable_bit = (1 << (free_space * 2));
-    auto mode_bits = (mode_flag << (free_space * 4 + 16));
-    auto size_bits = (size_flag << (free_space * 4 + 18));
+sdb::watchpoint* sdb::process::rerun_faulted_syscall(
+    thread_state& thread, syscall_information& info)
+{
+    // The kernel's accesses don't trap; they fail, having done nothing
+    // for the syscalls which matter here, such as read(2) into a watched
+    // buffer. So the syscall is run again with every page unprotected
+    std::vector<std::uint64_t> lifted;
+    for (auto& [page, entry] : protected_pages_) {
+        if (entry.writes == 0 and entry.accesses == 0) continue;
+        auto wanted = entry.original;
+        if (entry.executes > 0) wanted &= ~PROT_EXEC;
+        protect_page(thread, page, wanted);
+        lifted.push_back(page);
+    }
 
-    auto clear_mask = (0b11 << (free_space * 2)) | 
-        (0b1111 << (free_space * 4 + 16));
-    auto masked = control & ~clear_mask;
+    thread.regs->flush();
+    user_regs_struct regs;
+    read_gprs(regs, thread.tid);
+    regs.rax = regs.orig_rax;
+    regs.rip -= 2;
+    regs.orig_rax = -1;
+    write_gprs(regs, thread.tid);
 
-    masked |= enable_bit | mode_bits | size_bits;
+    int wait_status;
+    do {
+        wait_status = single_step_thread(thread);
+    } while (is_seccomp_stop(wait_status));
+    if (!WIFSTOPPED(wait_status)) {
+        error::send("Process ended during rerun syscall");
+    }
+    read_gprs(regs, thread.tid);
+    info.ret = regs.rax;
 
-    regs.write_by_id(register_id::dr7, masked);
+    for (auto page : lifted) {
+        protect_page(thread, page, protected_pages_.at(page).applied);
+    }
+    memory_cache_.clear();
 
-    return free_space;
+    // Reads by the kernel leave nothing to see, but its writes do
+    watchpoint* reported = nullptr;
+    watchpoints_.for_each([&](auto& point) {
+        if (!point.is_enabled() or point.mode() == stoppoint_mode::execute) {
+            return;
+        }
+        point.update_data();
+        if (!point.changed()) return;
+        hardware_stoppoints_.record_hit(hardware_stoppoint_id{
+            std::in_place_index<1>, point.id() });
+        if (should_report_hit(point, thread.tid) and !reported) {
+            reported = &point;
+        }
+    });
+    return reported;
 }
 
-void sdb::process::clear_hardware_stoppoint(int index) {
-    auto id = static_cast<int>(register_id::dr0) + index;
-    get_registers().write_by_id(static_cast<register_id>(id), 0);
+void sdb::process::update_page_protection(std::uint64_t page) {
+    auto& entry = protected_pages_.at(page);
+    auto wanted = entry.original;
+    if (entry.accesses > 0) {
+        wanted = PROT_NONE;
+    }
+    else if (entry.writes > 0) {
+        wanted &= ~PROT_WRITE;
+    }
+    if (entry.executes > 0) {
+        wanted &= ~PROT_EXEC;
+    }
 
-    auto control = get_registers().
-        read_by_id_as<std::uint64_t>(register_id::dr7);
+    if (wanted != entry.applied) {
+        auto& thread = threads_.at(current_thread_);
+        // Syscalls can't be patched over code which can't run, so they
+        // need a scratch page to run from first
+        if (!(wanted & PROT_EXEC) and !syscall_instruction_) {
+            add_scratch_page(thread, virt_addr{ page });
+        }
+        protect_page(thread, page, wanted);
+        entry.applied = wanted;
+    }
+    if (entry.accesses == 0 and entry.writes == 0 and entry.executes == 0) {
+        protected_pages_.erase(page);
+    }
+}
 
-    auto clear_mask = (0b11 << (index * 2)) | (0b1111 << (index * 4 + 16));
-    auto masked = control & ~clear_mask;
+void sdb::process::protect_page(
+    thread_state& thread, std::uint64_t page, int protection)
+{
+    auto result = inject_syscall(thread, SYS_mprotect,
+        { page, 0x1000, static_cast<std::uint64_t>(protection), 0, 0, 0 });
+    if (result != 0) {
+        error::send("Could not change protection of watched memory");
+    }
+    memory_cache_.erase(page);
+}
 
-    get_registers().write_by_id(register_id::dr7, masked);
+int sdb::process::page_protection(std::uint64_t page) const {
+    std::ifstream maps("/proc/" + std::to_string(pid_) + "/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        std::istringstream fields(line);
+        std::string range, perms;
+        fields >> range >> perms;
+
+        auto dash = range.find('-');
+        auto low = std::stoull(range.substr(0, dash), nullptr, 16);
+        auto high = std::stoull(range.substr(dash + 1), nullptr, 16);
+        if (page < low or page >= high or perms.size() < 3) continue;
+
+        auto protection = PROT_NONE;
+        if (perms[0] == 'r') protection |= PROT_READ;
+        if (perms[1] == 'w') protection |= PROT_WRITE;
+        if (perms[2] == 'x') protection |= PROT_EXEC;
+        return protection;
+    }
+    error::send("Watched memory is not mapped");
 }
 
-int sdb::process::set_watchpoint(
-    watchpoint::id_type id, virt_addr address,
-    stoppoint_mode mode, std::size_t size)
+std::optional<std::uint64_t> sdb::process::software_watch_fault(
+    pid_t tid, int wait_status) const
 {
-    return set_hardware_stoppoint(address, mode, size);
+    if (protected_pages_.empty() or !WIFSTOPPED(wait_status) or
+        WSTOPSIG(wait_status) != SIGSEGV) {
+        return std::nullopt;
+    }
+
+    siginfo_t info;
+    if (ptrace(PTRACE_GETSIGINFO, tid, nullptr, &info) < 0 or
+        info.si_code != SEGV_ACCERR) {
+        return std::nullopt;
+    }
+    auto address = reinterpret_cast<std::uint64_t>(info.si_addr);
+    if (!protected_pages_.count(address & ~std::uint64_t{ 0xfff })) {
+        return std::nullopt;
+    }
+    return address;
+}
+
+sdb::watchpoint* sdb::process::take_software_watch_hit(thread_state& thread) {
+    auto faults = std::exchange(thread.watch_faults, {});
+
+    watchpoint* hit = nullptr;
+    watchpoints_.for_each([&](auto& point) {
+        // Execute stoppoints are caught before the instruction runs
+        if (hit or !point.is_enabled() or
+            point.mode() == stoppoint_mode::execute or
+            hardware_stoppoints_.is_resident(
+                hardware_stoppoint_id{ std::in_place_index<1>, point.id() })) {
+            return;
+        }
+
+        auto low = point.address().addr();
+        auto high = low + point.size();
+        auto touched = false;
+        auto nearby = false;
+        for (auto fault : faults) {
+            auto page = fault & ~std::uint64_t{ 0xfff };
+            // Faults on a page which is only read-only are writes, but on
+            // an inaccessible one they may be reads, which don't count for
+            // write watchpoints
+            auto counts = point.mode() == stoppoint_mode::read_write or
+                (protected_pages_.at(page).applied & PROT_READ);
+            touched |= counts and fault >= low and fault < high;
+            nearby |= page >= (low & ~0xfff) and fault < high;
+        }
+        if (!nearby) return;
+
+        // Otherwise writes show up as a change to the data, as do those
+        // which start before the region and run into it
+        point.update_data();
+        if (touched or point.changed()) hit = &point;
+    });
+    return hit;
 }
 
 void sdb::process::augment_stop_reason(sdb::stop_reason& reason) {
     siginfo_t info;
-    if (ptrace(PTRACE_GETSIGINFO, pid_, nullptr, &info) < 0) {
+    if (ptrace(PTRACE_GETSIGINFO, reason.tid, nullptr, &info) < 0) {
         error::send_errno("Failed to get signal info");
     }
-
-    if (reason.info == (SIGTRAP | 0x80) or info.si_code == TRAP_BRKPT) {
+    auto& thread = threads_.at(reason.tid);
+
+    auto from_seccomp =
+        info.si_code == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8));
+    if (from_seccomp and thread.expecting_syscall_exit) {
+        // Under PTRACE_SYSCALL the filter's stop follows the entry stop,
+        // which was already seen. Leaving out the info marks it to be
+        // skipped
+        reason.info = SIGTRAP;
+        reason.trap_reason = trap_type::syscall;
+        return;
+    }
+    // Other signals reuse the same si_code values, e.g. SIGCHLD's
+    // CLD_EXITED is TRAP_BRKPT
+    if (reason.info == (SIGTRAP | 0x80) or from_seccomp or
+        (reason.info == SIGTRAP and info.si_code == TRAP_BRKPT)) {
         auto& sys_info = reason.syscall_info.emplace();
         auto& regs = get_registers();
 
-        if (expecting_syscall_exit_) {
+        if (thread.expecting_syscall_exit and !from_seccomp) {
             sys_info.entry = false;
             sys_info.id = regs.read_by_id_as<std::uint64_t>(
                 register_id::orig_rax);
             sys_info.ret = regs.read_by_id_as<std::uint64_t>(
                 register_id::rax);
-            expecting_syscall_exit_ = false;
+            thread.expecting_syscall_exit = false;
         }
         else {
             sys_info.entry = true;
@@ -448,7 +2580,7 @@ void sdb::process::augment_stop_reason(sdb::stop_reason& reason) {
                     arg_regs[i]);
             }
 
-            expecting_syscall_exit_ = true;
+            thread.expecting_syscall_exit = true;
         }
 
         reason.info = SIGTRAP;
@@ -456,7 +2588,7 @@ void sdb::process::augment_stop_reason(sdb::stop_reason& reason) {
         return;
     }
 
-    expecting_syscall_exit_ = false;
+    thread.expecting_syscall_exit = false;
 
     reason.trap_reason = trap_type::unknown;
     if (reason.info == SIGTRAP) {
@@ -474,42 +2606,118 @@ void sdb::process::augment_stop_reason(sdb::stop_reason& reason) {
     }
 }
 
+std::vector<sdb::hardware_stoppoint_id>
+sdb::process::triggered_stoppoints() {
+    auto& regs = get_registers();
+    auto status = regs.read_by_id_as<std::uint64_t>(register_id::dr6);
+    auto& slots = hardware_stoppoints_.slots();
+
+    // One access can trigger several registers
+    std::vector<hardware_stoppoint_id> ret;
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        if (!(status & (std::uint64_t{ 1 } << i)) or !slots[i]) continue;
+
+        // Watchpoints packed into a register of writes are told apart by
+        // which of them changed. Otherwise, or if none did, every owner was
+        // hit as far as we can tell
+        auto first = ret.size();
+        for (auto owner : slots[i]->owners) {
+            if (owner.index() != 1) continue;
+            auto& point = watchpoints_.get_by_id(std::get<1>(owner));
+            point.update_data();
+            if (slots[i]->mode == stoppoint_mode::write and point.changed()) {
+                ret.push_back(owner);
+            }
+        }
+        if (ret.size() == first) {
+            ret.insert(end(ret), begin(slots[i]->owners),
+                end(slots[i]->owners));
+        }
+    }
+    if (ret.empty()) {
+        error::send("No hardware stoppoint triggered");
+    }
+    return ret;
+}
+
 std::variant<sdb::breakpoint_site::id_type, sdb::watchpoint::id_type>
 sdb::process::get_current_hardware_stoppoint() const
 {
-    auto& regs = get_registers();
-    auto status = regs.read_by_id_as<std::uint64_t>(register_id::dr6);
-    auto index = __builtin_ctzll(status);
+    if (hardware_hits_.empty()) {
+        error::send("No hardware stoppoint triggered");
+    }
+    return hardware_hits_.front();
+}
 
-    auto id = static_cast<int>(register_id::dr0) + index;
-    auto addr = virt_addr(
-        regs.read_by_id_as<std::uint64_t>(static_cast<register_id>(id)));
+int sdb::process::step_through_page(thread_state& thread, std::uint64_t page) {
+    protect_page(thread, page, protected_pages_.at(page).original);
 
-    using ret = std::variant<sdb::breakpoint_site::id_type,
-          sdb::watchpoint::id_type>;
-    if (breakpoint_sites_.contains_address(addr)) {
-        auto site_id = breakpoint_sites_.get_by_address(addr).id();
-        return ret{ std::in_place_index<0>, site_id };
-    }
-    else {
-        auto watch_id = watchpoints_.get_by_address(addr).id();
-        return ret{ std::in_place_index<1>, watch_id };
+    int wait_status;
+    while (true) {
+        wait_status = single_step_thread(thread);
+        if (!WIFSTOPPED(wait_status) or WSTOPSIG(wait_status) != SIGTRAP or
+            !thread.watch_faults.empty()) {
+            break;
+        }
+
+        // Anything but a plain step, such as a debug register hit, is
+        // reported as it is
+        siginfo_t info;
+        if (ptrace(PTRACE_GETSIGINFO, thread.tid, nullptr, &info) < 0 or
+            info.si_code != TRAP_TRACE) {
+            break;
+        }
+        auto pc = thread.regs->read_by_id_as<std::uint64_t>(register_id::rip);
+        if ((pc & ~std::uint64_t{ 0xfff }) != page or
+            backed_execute_stoppoint(virt_addr{ pc })) {
+            break;
+        }
     }
+
+    protect_page(thread, page, protected_pages_.at(page).applied);
+    return wait_status;
 }
 
-sdb::stop_reason sdb::process::maybe_resume_from_syscall(
+std::optional<sdb::stop_reason> sdb::process::maybe_resume_from_syscall(
     const stop_reason& reason)
 {
+    // Only stopped at to watch for faults
+    if (syscall_catch_policy_.get_mode() == syscall_catch_policy::mode::none) {
+        resume_thread(threads_.at(reason.tid));
+        return std::nullopt;
+    }
     if (syscall_catch_policy_.get_mode() == syscall_catch_policy::mode::some) {
         auto& to_catch = syscall_catch_policy_.get_to_catch();
         auto found = std::find(
             begin(to_catch), end(to_catch), reason.syscall_info->id);
 
         if (found == end(to_catch)) {
-            resume();
-            return wait_on_signal();
+            auto& thread = threads_.at(reason.tid);
+            if (syscall_filter_active_ and reason.syscall_info->entry) {
+                // Don't bother stopping at the exit of a syscall which the
+                // filter traps but the policy doesn't want
+                thread.expecting_syscall_exit = false;
+            }
+            resume_thread(thread);
+            return std::nullopt;
         }
     }
 
     return reason;
 }
+
+void sdb::process::set_syscall_catch_policy(syscall_catch_policy info) {
+    syscall_catch_policy_ = std::move(info);
+
+    // The in-kernel filter can only stand in for PTRACE_SYSCALL if it traps
+    // every syscall the policy wants to catch
+    syscall_filter_active_ = false;
+    if (syscall_catch_policy_.get_mode() == syscall_catch_policy::mode::some
+        and !syscall_filter_.empty()) {
+        auto to_catch = syscall_catch_policy_.get_to_catch();
+        std::sort(begin(to_catch), end(to_catch));
+        syscall_filter_active_ = std::includes(
+            begin(syscall_filter_), end(syscall_filter_),
+            begin(to_catch), end(to_catch));
+    }
+}
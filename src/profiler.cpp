@@ -0,0 +1,113 @@
+#include <libsdb/profiler.hpp>
+#include <libsdb/error.hpp>
+#include <libsdb/bit.hpp>
+#include <sys/wait.h>
+#include <csignal>
+#include <algorithm>
+#include <thread>
+#include <ios>
+
+void sdb::profiler::run(unsigned hz,
+    std::optional<std::chrono::nanoseconds> duration,
+    std::function<bool()> stop_requested)
+{
+    if (hz == 0) {
+        error::send("Sampling rate must be positive");
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto period = std::chrono::nanoseconds(1'000'000'000 / hz);
+    auto start = clock::now();
+    auto next = start;
+    while (true) {
+        if (stop_requested and stop_requested()) break;
+        if (duration and clock::now() - start >= *duration) break;
+        if (!sample()) break;
+
+        // Ticks missed while sampling are dropped rather than bunched up
+        next = std::max(next + period, clock::now());
+        std::this_thread::sleep_until(next);
+    }
+}
+
+bool sdb::profiler::sample() {
+    if (!drain_stops()) return false;
+
+    process_->interrupt();
+    for (auto& [tid, thread] : process_->threads()) {
+        if (thread.pending_status and !WIFSTOPPED(*thread.pending_status)) {
+            continue;
+        }
+        auto frames = walk_stack(tid);
+        if (!frames.empty()) {
+            ++stacks_[frames];
+        }
+    }
+    ++samples_;
+
+    process_->resume();
+    return true;
+}
+
+bool sdb::profiler::drain_stops() {
+    while (auto reason = process_->try_wait()) {
+        if (reason->reason != process_state::stopped) return false;
+        auto signal = reason->info == SIGTRAP ? 0 : reason->info;
+        process_->resume(signal);
+    }
+    return process_->state() == process_state::running;
+}
+
+sdb::profiler::stack sdb::profiler::walk_stack(pid_t tid) const {
+    stack frames;
+    try {
+        auto& regs = process_->get_registers(tid);
+        auto pc = regs.read_by_id_as<std::uint64_t>(register_id::rip);
+        auto sp = regs.read_by_id_as<std::uint64_t>(register_id::rsp);
+        auto fp = regs.read_by_id_as<std::uint64_t>(register_id::rbp);
+        frames.push_back(pc);
+
+        // Each frame record is the caller's frame pointer followed by the
+        // return address, and callers live further up the stack
+        while (frames.size() < max_depth_ and fp >= sp and fp % 8 == 0) {
+            auto record = process_->read_memory(virt_addr{ fp }, 16);
+            auto next_fp = from_bytes<std::uint64_t>(record.data());
+            auto return_address = from_bytes<std::uint64_t>(record.data() + 8);
+            if (return_address == 0) break;
+
+            frames.push_back(return_address);
+            if (next_fp <= fp) break;
+            fp = next_fp;
+        }
+    }
+    catch (const error&) {}
+    return frames;
+}
+
+std::size_t sdb::profiler::stack_hash::operator()(const stack& frames) const {
+    std::size_t hash = frames.size();
+    for (auto frame : frames) {
+        hash ^= std::hash<std::uint64_t>{}(frame) +
+            0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+void sdb::profiler::write_folded(std::ostream& out) const {
+    std::vector<std::pair<const stack*, std::size_t>> sorted;
+    for (auto& [frames, count] : stacks_) {
+        sorted.emplace_back(&frames, count);
+    }
+    std::sort(begin(sorted), end(sorted),
+        [](auto& lhs, auto& rhs) { return lhs.second > rhs.second; });
+
+    auto flags = out.flags();
+    for (auto [frames, count] : sorted) {
+        for (auto it = frames->rbegin(); it != frames->rend(); ++it) {
+            if (it != frames->rbegin()) out << ';';
+            out << "0x" << std::hex << *it;
+        }
+        out << ' ' << std::dec << count << '\n';
+    }
+    out.flags(flags);
+}
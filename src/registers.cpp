@@ -4,6 +4,7 @@
 #include <libsdb/bit.hpp>
 #include <type_traits>
 #include <algorithm>
+#include <cstddef>
 
 namespace {
     template <class T>
@@ -27,9 +28,42 @@ namespace {
 
             return to_byte128(t);
         }
+
+    std::size_t debug_register_index(const sdb::register_info& info) {
+        return (info.offset - offsetof(user, u_debugreg)) / 8;
+    }
+}
+
+void sdb::registers::ensure_loaded(const register_info& info) const {
+    if (info.type == register_type::fpr) {
+        if (!fprs_loaded_) {
+            proc_->read_fprs(data_.i387, tid_);
+            fprs_loaded_ = true;
+        }
+    }
+    else if (info.type == register_type::dr) {
+        auto index = debug_register_index(info);
+        if (!(loaded_debug_registers_ & (1 << index))) {
+            data_.u_debugreg[index] = proc_->read_user_area(
+                offsetof(user, u_debugreg) + index * 8, tid_);
+            loaded_debug_registers_ |= 1 << index;
+        }
+    }
+    else if (!gprs_loaded_) {
+        proc_->read_gprs(data_.regs, tid_);
+        gprs_loaded_ = true;
+    }
+}
+
+void sdb::registers::invalidate() {
+    gprs_loaded_ = false;
+    fprs_loaded_ = false;
+    // Debug registers written while the thread ran haven't been pushed yet
+    loaded_debug_registers_ = dirty_debug_registers_;
 }
 
 sdb::registers::value sdb::registers::read(const register_info& info) const {
+    ensure_loaded(info);
     auto bytes = as_bytes(data_);
 
     if (info.format == register_format::uint) {
@@ -58,6 +92,13 @@ sdb::registers::value sdb::registers::read(const register_info& info) const {
 }
 
 void sdb::registers::write(const register_info& info, value val) {
+    // Debug registers are always written whole, so there's nothing to fetch
+    if (info.type == register_type::dr) {
+        loaded_debug_registers_ |= 1 << debug_register_index(info);
+    }
+    else {
+        ensure_loaded(info);
+    }
     auto bytes = as_bytes(data_);
 
     std::visit([&](auto& v) {
@@ -74,11 +115,43 @@ void sdb::registers::write(const register_info& info, value val) {
     }, val);
 
     if (info.type == register_type::fpr) {
-        proc_->write_fprs(data_.i387);
+        fprs_dirty_ = true;
+    }
+    else if (info.type == register_type::dr) {
+        dirty_debug_registers_ |= 1 << debug_register_index(info);
     }
     else {
-        auto aligned_offset = info.offset & ~0b111;
-        proc_->write_user_area(aligned_offset, 
-            from_bytes<std::uint64_t>(bytes + aligned_offset));
+        gprs_dirty_ = true;
+    }
+    ++pending_writes_;
+}
+
+void sdb::registers::flush() {
+    std::size_t calls = 0;
+
+    if (gprs_dirty_) {
+        gprs_dirty_ = false;
+        proc_->write_gprs(data_.regs, tid_);
+        ++calls;
+    }
+    if (fprs_dirty_) {
+        fprs_dirty_ = false;
+        proc_->write_fprs(data_.i387, tid_);
+        ++calls;
+    }
+    // Addresses in dr0-dr3 must be in place before dr7 enables them, so
+    // these go out in index order
+    for (auto i = 0; i < 8; ++i) {
+        if (dirty_debug_registers_ & (1 << i)) {
+            dirty_debug_registers_ &= ~(1 << i);
+            proc_->write_user_area(
+                offsetof(user, u_debugreg) + i * 8, data_.u_debugreg[i], tid_);
+            ++calls;
+        }
+    }
+
+    if (pending_writes_ > calls) {
+        ptrace_calls_saved_ += pending_writes_ - calls;
     }
+    pending_writes_ = 0;
 }
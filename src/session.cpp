@@ -0,0 +1,140 @@
+#include <libsdb/session.hpp>
+#include <libsdb/error.hpp>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <algorithm>
+
+namespace {
+    bool is_alive(const sdb::process& proc) {
+        return proc.state() == sdb::process_state::stopped or
+            proc.state() == sdb::process_state::running;
+    }
+}
+
+sdb::process& sdb::session::launch(
+    std::filesystem::path path, std::optional<int> stdout_replacement) {
+    return add(process::launch(
+        std::move(path), /*debug=*/true, stdout_replacement));
+}
+
+sdb::process& sdb::session::attach(pid_t pid) {
+    return add(process::attach(pid));
+}
+
+sdb::process& sdb::session::add(std::unique_ptr<process> proc) {
+    proc->follow_forks();
+    processes_.push_back(std::move(proc));
+    return *processes_.back();
+}
+
+sdb::process* sdb::session::find(pid_t pid) const {
+    auto it = std::find_if(begin(processes_), end(processes_),
+        [=](auto& proc) { return proc->pid() == pid; });
+    return it == end(processes_) ? nullptr : it->get();
+}
+
+void sdb::session::remove(pid_t pid) {
+    detach_after_exec_.erase(pid);
+    processes_.erase(std::remove_if(begin(processes_), end(processes_),
+        [=](auto& proc) { return proc->pid() == pid; }), end(processes_));
+}
+
+sdb::process* sdb::session::find_owner(pid_t tid) const {
+    // Exited processes are skipped since their pids can be reused
+    for (auto& proc : processes_) {
+        if (is_alive(*proc) and proc->threads().count(tid)) {
+            return proc.get();
+        }
+    }
+    for (auto& proc : processes_) {
+        if (is_alive(*proc) and proc->owns_thread(tid)) {
+            return proc.get();
+        }
+    }
+    return nullptr;
+}
+
+sdb::session::event sdb::session::wait() {
+    return *next_event(/*block=*/true);
+}
+
+std::optional<sdb::session::event> sdb::session::try_wait() {
+    return next_event(/*block=*/false);
+}
+
+void sdb::session::resume_all() {
+    for (auto& proc : processes_) {
+        if (proc->state() == process_state::stopped) {
+            proc->resume();
+        }
+    }
+}
+
+std::optional<sdb::session::event> sdb::session::next_event(bool block) {
+    while (true) {
+        // Dispatching can add processes, so no iterators here
+        for (std::size_t i = 0; i < processes_.size(); ++i) {
+            auto& proc = *processes_[i];
+            if (!is_alive(proc)) continue;
+            if (auto ready = proc.take_ready_status()) {
+                auto [tid, status] = *ready;
+                if (auto ev = dispatch(proc, tid, status)) return ev;
+            }
+        }
+
+        auto next = process::reap_wait_status(block);
+        if (!next) return std::nullopt;
+        auto [tid, wait_status] = *next;
+
+        auto owner = find_owner(tid);
+        if (!owner) {
+            // Most likely a new child whose first stop beat the fork event
+            process::park_wait_status(tid, wait_status);
+            continue;
+        }
+        if (auto ev = dispatch(*owner, tid, wait_status)) return ev;
+    }
+}
+
+std::optional<sdb::session::event> sdb::session::dispatch(
+    process& proc, pid_t tid, int status) {
+    auto reason = proc.handle_wait_status(tid, status);
+    if (!reason) return std::nullopt;
+
+    if (reason->trap_reason == trap_type::fork) {
+        auto child = proc.adopt_fork_child(*reason, inherit_breakpoints_);
+        auto keep = follow_forks_ or reason->shares_memory;
+        if (keep) {
+            if (!follow_forks_) {
+                detach_after_exec_.insert(child->pid());
+            }
+            processes_.push_back(std::move(child));
+        }
+        else {
+            // Destroying the child detaches it with its breakpoints removed
+            child->terminate_on_end_ = false;
+            child.reset();
+        }
+
+        if (stop_on_fork_) return event{ &proc, *reason };
+        if (keep) {
+            processes_.back()->resume();
+        }
+        proc.resume();
+        return std::nullopt;
+    }
+
+    if (reason->trap_reason == trap_type::exec) {
+        if (detach_after_exec_.count(proc.pid())) {
+            proc.terminate_on_end_ = false;
+            remove(proc.pid());
+            return std::nullopt;
+        }
+        if (!stop_on_exec_) {
+            proc.resume();
+            return std::nullopt;
+        }
+    }
+
+    return event{ &proc, *reason };
+}
@@ -0,0 +1,66 @@
+#include <libsdb/syscall_tracer.hpp>
+#include <libsdb/error.hpp>
+#include <csignal>
+
+void sdb::latency_histogram::add(std::uint64_t nanoseconds) {
+    auto bucket = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    ++buckets[bucket];
+    ++count;
+    total += nanoseconds;
+    min = std::min(min, nanoseconds);
+    max = std::max(max, nanoseconds);
+}
+
+sdb::syscall_tracer::syscall_tracer(process& proc, std::size_t capacity)
+    : process_(&proc), records_(capacity)
+{
+    // Recording a syscall shouldn't have to allocate
+    records_.reserve();
+}
+
+void sdb::syscall_tracer::run(std::function<bool()> stop_requested) {
+    // Only the thread making the syscall needs to stop for it
+    process_->set_stop_mode(stop_mode::non_stop);
+    if (process_->state() == process_state::stopped) {
+        process_->resume_all_threads();
+    }
+
+    while (true) {
+        auto reason = process_->wait_on_signal();
+        if (reason.reason == process_state::exited or
+            reason.reason == process_state::terminated) {
+            exit_reason_ = reason;
+            return;
+        }
+
+        auto is_syscall = record(reason);
+        if (stop_requested and stop_requested()) return;
+
+        if (is_syscall or reason.info == SIGTRAP) {
+            process_->resume();
+        }
+        else {
+            process_->resume(reason.info);
+        }
+    }
+}
+
+bool sdb::syscall_tracer::record(const stop_reason& reason) {
+    if (reason.trap_reason != trap_type::syscall) return false;
+
+    using namespace std::chrono;
+    std::uint64_t now = duration_cast<nanoseconds>(
+        steady_clock::now() - start_).count();
+    auto& info = *reason.syscall_info;
+    records_.push({ now, reason.tid, info });
+
+    if (info.entry) {
+        open_syscalls_[reason.tid] = { info.id, now };
+    }
+    else if (auto it = open_syscalls_.find(reason.tid);
+             it != end(open_syscalls_) and it->second.id == info.id) {
+        latencies_[info.id].add(now - it->second.timestamp);
+        open_syscalls_.erase(it);
+    }
+    return true;
+}
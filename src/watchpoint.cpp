@@ -2,6 +2,8 @@
 #include <libsdb/process.hpp>
 #include <libsdb/error.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <utility>
 
 namespace {
@@ -12,11 +14,30 @@ namespace {
 }
 
 void sdb::watchpoint::update_data() {
-    std::uint64_t new_data = 0;
     auto read = process_->read_memory(address_, size_);
 
-    memcpy(&new_data, read.data(), size_);
-    previous_data_ = std::exchange(data_, new_data);
+    // Larger regions show the aligned 8 bytes holding the first change
+    auto width = std::min<std::size_t>(size_, 8);
+    data_offset_ = 0;
+    if (contents_.size() == read.size()) {
+        auto diff = std::mismatch(
+            begin(read), end(read), begin(contents_)).first;
+        if (diff != end(read)) {
+            auto offset = static_cast<std::size_t>(diff - begin(read));
+            data_offset_ = std::min(offset & ~std::size_t{ 7 }, size_ - width);
+        }
+    }
+
+    std::uint64_t new_data = 0;
+    std::uint64_t old_data = 0;
+    memcpy(&new_data, read.data() + data_offset_, width);
+    if (!contents_.empty()) {
+        memcpy(&old_data, contents_.data() + data_offset_, width);
+    }
+    changed_ = !contents_.empty() and contents_ != read;
+    previous_data_ = old_data;
+    data_ = new_data;
+    contents_ = std::move(read);
 }
 
 sdb::watchpoint::watchpoint(
@@ -24,8 +45,8 @@ sdb::watchpoint::watchpoint(
     : process_{ &proc }, address_{ address }, is_enabled_{ false },
     mode_{ mode }, size_{ size }
 {
-    if ((address.addr() & (size - 1)) != 0) {
-        error::send("Watchpoint must be aligned to size");
+    if (size == 0) {
+        error::send("Watchpoint size must be positive");
     }
 
     id_ = get_next_id();
@@ -35,14 +56,20 @@ sdb::watchpoint::watchpoint(
 void sdb::watchpoint::enable() {
     if (is_enabled_) return;
 
-    hardware_register_index_ = 
-        process_->set_watchpoint(id_, address_, mode_, size_);
+    is_hardware_ = process_->set_watchpoint(id_, address_, mode_, size_);
     is_enabled_ = true;
 }
 
 void sdb::watchpoint::disable() {
     if (!is_enabled_) return;
 
-    process_->clear_hardware_stoppoint(hardware_register_index_);
+    if (is_hardware()) {
+        process_->clear_hardware_stoppoint(
+            hardware_stoppoint_id{ std::in_place_index<1>, id_ });
+    }
+    else {
+        process_->clear_software_watchpoint(address_, mode_, size_);
+    }
+    is_hardware_ = false;
     is_enabled_ = false;
 }
@@ -0,0 +1,93 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/pipe.hpp>
+#include <libsdb/bit.hpp>
+#include <libsdb/instruction_trace.hpp>
+
+#include <sys/ptrace.h>
+#include <signal.h>
+#include <unistd.h>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+using namespace sdb;
+
+namespace {
+    std::unique_ptr<process> launch_large_buffer(virt_addr& buffer) {
+        bool close_on_exec = false;
+        sdb::pipe channel(close_on_exec);
+        auto proc = process::launch("build/test/targets/large_buffer", true,
+                channel.get_write());
+        channel.close_write();
+
+        proc->resume();
+        proc->wait_on_signal();
+
+        buffer = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+        return proc;
+    }
+
+    // What process::write_memory used to do: one PTRACE_POKEDATA per word
+    void poke_memory(pid_t pid, virt_addr address, span<const std::byte> data) {
+        for (std::size_t written = 0; written < data.size(); written += 8) {
+            auto word = from_bytes<std::uint64_t>(data.begin() + written);
+            ptrace(PTRACE_POKEDATA, pid, address + written, word);
+        }
+    }
+}
+
+TEST_CASE("Memory write throughput", "[benchmark][memory]") {
+    virt_addr buffer;
+    auto proc = launch_large_buffer(buffer);
+    std::vector<std::byte> data(1 << 20, std::byte{ 0x42 });
+
+    for (std::size_t size : { 8, 256, 4096, 65536, 1 << 20 }) {
+        span<const std::byte> to_write{ data.data(), size };
+        auto suffix = " " + std::to_string(size) + " bytes";
+
+        BENCHMARK("write_memory" + suffix) {
+            proc->write_memory(buffer, to_write);
+        };
+        BENCHMARK("PTRACE_POKEDATA" + suffix) {
+            poke_memory(proc->pid(), buffer, to_write);
+        };
+    }
+}
+
+TEST_CASE("Instruction trace throughput", "[benchmark][trace]") {
+    constexpr std::size_t steps = 1000;
+    auto path = std::filesystem::temp_directory_path() /
+        ("sdb_trace_bench_" + std::to_string(getpid()));
+    auto proc = process::launch("build/test/targets/run_endlessly");
+
+    auto report_rate = [&](const char* name, auto run) {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        run();
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        std::cout << name << ": "
+            << static_cast<std::size_t>(steps / elapsed.count())
+            << " steps/s\n";
+    };
+
+    auto step = [&] {
+        for (std::size_t i = 0; i < steps; ++i) {
+            proc->step_instruction();
+        }
+    };
+    BENCHMARK("step_instruction x1000") { step(); };
+    report_rate("step_instruction", step);
+
+    for (bool registers : { false, true }) {
+        instruction_trace trace(path, registers);
+        auto run = [&] { proc->trace_instructions(steps, trace); };
+        auto name = registers ?
+            "trace_instructions with registers" : "trace_instructions";
+
+        BENCHMARK(std::string(name) + " x1000") { run(); };
+        report_rate(name, run);
+    }
+    std::filesystem::remove(path);
+}
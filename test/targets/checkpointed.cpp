@@ -0,0 +1,22 @@
+#include <cstdio>
+#include <unistd.h>
+#include <signal.h>
+
+volatile int counter = 0;
+
+__attribute__((noinline)) void bump() {
+    ++counter;
+}
+
+int main() {
+    void* addresses[] = { (void*)&counter, (void*)&bump };
+    write(STDOUT_FILENO, addresses, sizeof(addresses));
+    fflush(stdout);
+
+    for (int i = 0; i < 3; ++i) {
+        bump();
+        raise(SIGTRAP);
+    }
+    std::printf("%d", counter);
+    fflush(stdout);
+}
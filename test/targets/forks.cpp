@@ -0,0 +1,32 @@
+#include <cstdio>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+__attribute__((noinline)) void marker() {
+    std::printf("m");
+    std::fflush(stdout);
+}
+
+int main() {
+    auto marker_address = &marker;
+    write(STDOUT_FILENO, &marker_address, sizeof(void*));
+    fflush(stdout);
+
+    raise(SIGTRAP);
+
+    for (int i = 0; i < 2; ++i) {
+        if (fork() == 0) {
+            marker();
+            execl("build/test/targets/end_immediately",
+                "end_immediately", nullptr);
+            _exit(1);
+        }
+    }
+
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) or WEXITSTATUS(status) != 0) return 1;
+    }
+    marker();
+}
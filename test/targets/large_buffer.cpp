@@ -0,0 +1,13 @@
+#include <cstdio>
+#include <unistd.h>
+#include <signal.h>
+
+char buffer[1 << 20];
+
+int main() {
+    auto buffer_address = &buffer;
+    write(STDOUT_FILENO, &buffer_address, sizeof(void*));
+    fflush(stdout);
+
+    raise(SIGTRAP);
+}
@@ -0,0 +1,26 @@
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <signal.h>
+
+__attribute__((noinline)) void worker(int id) {
+    std::printf("%d", id);
+    std::fflush(stdout);
+}
+
+int main() {
+    auto worker_address = &worker;
+    write(STDOUT_FILENO, &worker_address, sizeof(void*));
+    fflush(stdout);
+
+    raise(SIGTRAP);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
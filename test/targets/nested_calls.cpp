@@ -0,0 +1,22 @@
+#include <cstdio>
+#include <unistd.h>
+#include <signal.h>
+
+__attribute__((noinline)) int inner(int i) {
+    return i * 2;
+}
+
+__attribute__((noinline)) int outer(int i) {
+    return inner(i) + 1;
+}
+
+int main() {
+    auto outer_address = &outer;
+    write(STDOUT_FILENO, &outer_address, sizeof(void*));
+    fflush(stdout);
+
+    raise(SIGTRAP);
+
+    std::printf("%d", outer(20));
+    fflush(stdout);
+}
@@ -0,0 +1,34 @@
+#include <cstdint>
+#include <unistd.h>
+#include <signal.h>
+
+extern "C" void scrambled();
+__attribute__((noinline)) void scramble();
+
+// What rbp points at while scramble uses it as a general register. It looks
+// like a frame whose return address is scramble itself
+extern "C" {
+    std::uint64_t decoy_frame[2] = {
+        0, reinterpret_cast<std::uint64_t>(&scramble) };
+}
+
+__attribute__((noinline)) void scramble() {
+    asm volatile(
+        "push %%rbp\n"
+        "lea decoy_frame(%%rip), %%rbp\n"
+        ".globl scrambled\n"
+        "scrambled:\n"
+        "nop\n"
+        "pop %%rbp\n"
+        ::: "memory");
+}
+
+int main() {
+    auto scrambled_address = &scrambled;
+    write(STDOUT_FILENO, &scrambled_address, sizeof(void*));
+
+    raise(SIGTRAP);
+
+    scramble();
+    write(STDOUT_FILENO, "returned", 8);
+}
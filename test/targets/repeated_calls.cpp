@@ -0,0 +1,22 @@
+#include <cstdio>
+#include <unistd.h>
+#include <signal.h>
+
+__attribute__((noinline)) int step(int i) {
+    return i * 3;
+}
+
+int main() {
+    auto step_address = &step;
+    write(STDOUT_FILENO, &step_address, sizeof(void*));
+    fflush(stdout);
+
+    raise(SIGTRAP);
+
+    int sum = 0;
+    for (int i = 0; i < 100; ++i) {
+        sum += step(i);
+    }
+    std::printf("%d", sum);
+    fflush(stdout);
+}
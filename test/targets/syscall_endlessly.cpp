@@ -0,0 +1,9 @@
+#include <sched.h>
+#include <unistd.h>
+
+int main() {
+    while (true) {
+        getppid();
+        sched_yield();
+    }
+}
@@ -0,0 +1,22 @@
+#include <cstdio>
+#include <unistd.h>
+#include <signal.h>
+
+// Larger than a debug register can watch
+char buffer[64];
+
+int main() {
+    int fds[2];
+    pipe(fds);
+    write(fds[1], "hello", 5);
+
+    auto buffer_address = &buffer;
+    write(STDOUT_FILENO, &buffer_address, sizeof(void*));
+    fflush(stdout);
+
+    raise(SIGTRAP);
+
+    auto n = read(fds[0], buffer, 5);
+    std::printf("%zd %.5s", n, buffer);
+    fflush(stdout);
+}
@@ -0,0 +1,31 @@
+#include <cstdio>
+#include <cstdint>
+#include <unistd.h>
+#include <signal.h>
+
+// The fields around values share its first and last pages
+struct {
+    std::uint64_t before;
+    std::uint64_t values[512];
+    std::uint64_t after;
+} data;
+
+int main() {
+    auto values_address = &data.values;
+    write(STDOUT_FILENO, &values_address, sizeof(void*));
+    fflush(stdout);
+
+    raise(SIGTRAP);
+
+    data.before = 1;
+    data.values[10] = 0xcafe;
+    data.after = 2;
+    data.values[511] = 0xba5e;
+
+    std::uint64_t sum = data.before + data.after;
+    for (auto value : data.values) {
+        sum += value;
+    }
+    std::printf("%llu", static_cast<unsigned long long>(sum));
+    fflush(stdout);
+}
@@ -4,10 +4,23 @@
 #include <libsdb/pipe.hpp>
 #include <libsdb/bit.hpp>
 #include <libsdb/syscalls.hpp>
+#include <libsdb/instruction_cache.hpp>
+#include <libsdb/debug_registers.hpp>
+#include <libsdb/disassembler.hpp>
+#include <libsdb/session.hpp>
+#include <libsdb/profiler.hpp>
+#include <libsdb/syscall_tracer.hpp>
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/coverage.hpp>
+#include <libsdb/latency_tracer.hpp>
+#include <libsdb/ring_buffer.hpp>
 
 #include <sys/types.h>
 #include <signal.h>
+#include <sys/wait.h>
+#include <poll.h>
 #include <fstream>
+#include <sstream>
 #include <elf.h>
 #include <regex>
 
@@ -168,6 +181,33 @@ TEST_CASE("Write register works", "[register]") {
     proc->wait_on_signal();
 }
 
+TEST_CASE("Register writes are batched until resume", "[register]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+
+    auto proc = process::launch(
+        "build/test/targets/reg_write", true, channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto& regs = proc->get_registers();
+    regs.write_by_id(register_id::rdi, 0);
+    regs.write_by_id(register_id::rdx, 0);
+    regs.write_by_id(register_id::rsi, 0xcafecafe);
+    REQUIRE(regs.read_by_id_as<std::uint64_t>(register_id::rsi) == 0xcafecafe);
+
+    regs.flush();
+    REQUIRE(regs.ptrace_calls_saved() == 2);
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto output = channel.read();
+    REQUIRE(to_string_view(output) == "0xcafecafe");
+}
+
 TEST_CASE("Read register works", "[register]") {
     auto proc = process::launch("build/test/targets/reg_read");
     auto& regs = proc->get_registers();
@@ -249,6 +289,34 @@ TEST_CASE("Can find breakpoint site", "[breakpoint]") {
     REQUIRE(cs2.address().addr() == 45);
 }
 
+TEST_CASE("Stoppoints can't share an address", "[breakpoint]") {
+    auto proc = process::launch("build/test/targets/run_endlessly");
+    auto& site = proc->create_breakpoint_site(virt_addr{ 42 });
+    REQUIRE_THROWS_AS(proc->create_breakpoint_site(virt_addr{ 42 }), error);
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+    auto& sites = proc->breakpoint_sites();
+    REQUIRE(&sites.get_by_address(virt_addr{ 42 }) == &site);
+
+    // The collection guards itself too, without indexing the duplicate
+    struct point {
+        using id_type = std::int32_t;
+        id_type id_;
+        virt_addr address_;
+        id_type id() const { return id_; }
+        virt_addr address() const { return address_; }
+    };
+    stoppoint_collection<point> points;
+    auto& first = points.push(
+        std::make_unique<point>(point{ 1, virt_addr{ 42 } }));
+    REQUIRE_THROWS_AS(
+        points.push(std::make_unique<point>(point{ 2, virt_addr{ 42 } })),
+        error);
+    REQUIRE(points.size() == 1);
+    REQUIRE(!points.contains_id(2));
+    REQUIRE(&points.get_by_id(1) == &first);
+    REQUIRE(&points.get_by_address(virt_addr{ 42 }) == &first);
+}
+
 TEST_CASE("Cannot find breakpoint site", "[breakpoint]") {
     auto proc = process::launch("build/test/targets/run_endlessly");
     const auto& cproc = proc;
@@ -303,6 +371,31 @@ TEST_CASE("Can iterate breakpoint sites", "[breakpoint]") {
     });
 }
 
+TEST_CASE("Can find breakpoint sites in region", "[breakpoint]") {
+    auto proc = process::launch("build/test/targets/run_endlessly");
+
+    proc->create_breakpoint_site(virt_addr{ 45 });
+    proc->create_breakpoint_site(virt_addr{ 42 });
+    proc->create_breakpoint_site(virt_addr{ 50 });
+    proc->create_breakpoint_site(virt_addr{ 43 });
+
+    auto sites = proc->breakpoint_sites().get_in_region(
+        virt_addr{ 42 }, virt_addr{ 45 });
+    REQUIRE(sites.size() == 2);
+    REQUIRE(sites[0]->address().addr() == 42);
+    REQUIRE(sites[1]->address().addr() == 43);
+
+    sites = proc->breakpoint_sites().get_in_region(
+        virt_addr{ 44 }, virt_addr{ 51 });
+    REQUIRE(sites.size() == 2);
+    REQUIRE(sites[0]->address().addr() == 45);
+    REQUIRE(sites[1]->address().addr() == 50);
+
+    REQUIRE(virt_addr{ 42 } < virt_addr{ 43 });
+    REQUIRE(!(virt_addr{ 43 } < virt_addr{ 42 }));
+    REQUIRE(!(virt_addr{ 42 } < virt_addr{ 42 }));
+}
+
 TEST_CASE("Breakpoint on address works", "[breakpoint]") {
     bool close_on_exec = false;
     sdb::pipe channel(close_on_exec);
@@ -332,6 +425,49 @@ TEST_CASE("Breakpoint on address works", "[breakpoint]") {
     REQUIRE(to_string_view(data) == "Hello, sdb!\n");
 }
 
+TEST_CASE("Breakpoint sites can be enabled in bulk", "[breakpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+
+    auto proc = process::launch("build/test/targets/hello_sdb", true,
+            channel.get_write());
+    channel.close_write();
+
+    auto offset = get_entry_point_offset("build/test/targets/hello_sdb");
+    auto load_address = get_load_address(proc->pid(), offset);
+    auto original = proc->read_memory(load_address, 4);
+
+    std::vector<virt_addr> addresses = {
+        load_address + 3, load_address, load_address + 1, load_address + 2
+    };
+    auto sites = proc->create_breakpoint_sites(addresses);
+    REQUIRE(sites.size() == 4);
+    REQUIRE(proc->breakpoint_sites().size() == 4);
+
+    proc->enable_all_breakpoint_sites();
+    for (auto site : sites) {
+        REQUIRE(site->is_enabled());
+    }
+
+    auto patched = proc->read_memory(load_address, 4);
+    for (auto byte : patched) {
+        REQUIRE(byte == std::byte{ 0xcc });
+    }
+    REQUIRE(proc->read_memory_without_traps(load_address, 4) == original);
+
+    for (auto address : addresses) {
+        proc->breakpoint_sites().remove_by_address(address);
+    }
+    REQUIRE(proc->read_memory(load_address, 4) == original);
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(reason.info == 0);
+    REQUIRE(to_string_view(channel.read()) == "Hello, sdb!\n");
+}
+
 TEST_CASE("Can remove breakpoint sites", "[breakpoint]") {
     auto proc = process::launch("build/test/targets/run_endlessly");
 
@@ -372,6 +508,41 @@ TEST_CASE("Reading and writing memory works", "[memory]") {
     REQUIRE(to_string_view(read) == "Hello, sdb!");
 }
 
+TEST_CASE("Memory reads are cached while stopped", "[memory]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/memory", true,
+            channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto a_pointer = virt_addr{
+        from_bytes<std::uint64_t>(channel.read().data()) };
+    REQUIRE(proc->read_memory_as<std::uint64_t>(a_pointer) == 0xcafecafe);
+    auto misses = proc->memory_cache_misses();
+    auto hits = proc->memory_cache_hits();
+
+    REQUIRE(proc->read_memory_as<std::uint64_t>(a_pointer) == 0xcafecafe);
+    REQUIRE(proc->memory_cache_misses() == misses);
+    REQUIRE(proc->memory_cache_hits() > hits);
+
+    std::uint64_t new_value = 0xba5eba11;
+    proc->write_memory(a_pointer, { as_bytes(new_value), sizeof(new_value) });
+    REQUIRE(proc->read_memory_as<std::uint64_t>(a_pointer) == 0xba5eba11);
+    REQUIRE(proc->memory_cache_misses() == misses);
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    REQUIRE(proc->read_memory_as<std::uint64_t>(a_pointer) == 0xba5eba11);
+    REQUIRE(proc->memory_cache_misses() > misses);
+
+    REQUIRE_THROWS_WITH(proc->read_memory(virt_addr{ 0x1000 }, 8),
+        "Could not read process memory at address 4096");
+}
+
 TEST_CASE("Hardware breakpoint evades memory checksums", "[breakpoint]") {
     bool close_on_exec = false;
     sdb::pipe channel(close_on_exec);
@@ -446,6 +617,216 @@ TEST_CASE("Watchpoint detects read", "[watchpoint]") {
         to_string_view(channel.read()) == "Putting sardines on pizza...\n");
 }
 
+TEST_CASE("Step over and step out run whole calls", "[step]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/nested_calls", true,
+            channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto outer = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+    proc->create_breakpoint_site(outer).enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.trap_reason == trap_type::software_break);
+    REQUIRE(proc->get_pc() == outer);
+
+    sdb::disassembler disas(*proc);
+    while (disas.disassemble(1)[0].kind != instruction_kind::call) {
+        reason = proc->step_over();
+        REQUIRE(reason.trap_reason == trap_type::single_step);
+    }
+
+    auto call = disas.disassemble(1)[0];
+    auto rsp = proc->get_registers().read_by_id_as<std::uint64_t>(
+        register_id::rsp);
+    reason = proc->step_over();
+
+    REQUIRE(reason.trap_reason == trap_type::single_step);
+    REQUIRE(proc->get_pc() == call.address + call.length);
+    REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(
+        register_id::rsp) == rsp);
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+
+    reason = proc->step_out();
+
+    REQUIRE(reason.trap_reason == trap_type::single_step);
+    REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(
+        register_id::rsp) > rsp);
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "41");
+}
+
+TEST_CASE("Step out doesn't trust rbp which isn't a frame pointer",
+    "[step]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/no_frame_pointer", true,
+            channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto scrambled = virt_addr(
+        from_bytes<std::uint64_t>(channel.read().data()));
+    proc->create_breakpoint_site(scrambled).enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.trap_reason == trap_type::software_break);
+
+    // Below the saved rbp and the frame scramble set up itself
+    auto rsp = proc->get_registers().read_by_id_as<std::uint64_t>(
+        register_id::rsp);
+    auto return_address = proc->read_memory_as<std::uint64_t>(
+        virt_addr{ rsp + 16 });
+
+    reason = proc->step_out();
+    REQUIRE(reason.trap_reason == trap_type::single_step);
+    REQUIRE(proc->get_pc().addr() == return_address);
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "returned");
+}
+
+TEST_CASE("Breakpoints trigger in every thread", "[thread]") {
+    for (auto hardware : { false, true }) {
+        bool close_on_exec = false;
+        sdb::pipe channel(close_on_exec);
+        auto proc = process::launch("build/test/targets/multi_threaded", true,
+                channel.get_write());
+        channel.close_write();
+
+        proc->resume();
+        proc->wait_on_signal();
+
+        auto worker = virt_addr(
+            from_bytes<std::uint64_t>(channel.read().data()));
+        proc->create_breakpoint_site(worker, hardware).enable();
+
+        auto expected = hardware ?
+            trap_type::hardware_break : trap_type::software_break;
+        int hits = 0;
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        while (reason.reason == process_state::stopped) {
+            REQUIRE(reason.trap_reason == expected);
+            REQUIRE(reason.tid != proc->pid());
+            REQUIRE(proc->current_thread() == reason.tid);
+            REQUIRE(proc->threads().size() > 1);
+            REQUIRE(proc->get_pc() == worker);
+            ++hits;
+
+            proc->resume();
+            reason = proc->wait_on_signal();
+        }
+
+        REQUIRE(reason.reason == process_state::exited);
+        REQUIRE(reason.info == 0);
+        REQUIRE(hits == 4);
+        REQUIRE(to_string_view(channel.read()).size() == 4);
+    }
+}
+
+TEST_CASE("Session follows forks and execs", "[session]") {
+    struct config {
+        bool follow;
+        bool inherit;
+        int expected_hits;
+    };
+    for (auto [follow, inherit, expected_hits] : {
+            config{ true, true, 3 },
+            config{ true, false, 1 },
+            config{ false, true, 1 } }) {
+        bool close_on_exec = false;
+        sdb::pipe channel(close_on_exec);
+        session session;
+        session.set_follow_forks(follow);
+        session.set_inherit_breakpoints(inherit);
+        session.set_stop_on_exec(true);
+        auto& parent = session.launch(
+            "build/test/targets/forks", channel.get_write());
+        channel.close_write();
+
+        parent.resume();
+        session.wait();
+
+        auto marker = virt_addr(
+            from_bytes<std::uint64_t>(channel.read().data()));
+        parent.create_breakpoint_site(marker).enable();
+
+        int hits = 0;
+        int execs = 0;
+        int exits = 0;
+        session.resume_all();
+        while (true) {
+            auto [proc, reason] = session.wait();
+            if (reason.reason != process_state::stopped) {
+                REQUIRE(reason.reason == process_state::exited);
+                REQUIRE(reason.info == 0);
+                ++exits;
+                if (proc == &parent) break;
+                continue;
+            }
+
+            // The parent also stops for SIGCHLD as its children exit
+            if (reason.trap_reason == trap_type::software_break) {
+                REQUIRE(proc->get_pc() == marker);
+                ++hits;
+            }
+            else if (reason.trap_reason == trap_type::exec) {
+                REQUIRE(proc->breakpoint_sites().empty());
+                ++execs;
+            }
+            proc->resume();
+        }
+
+        REQUIRE(hits == expected_hits);
+        REQUIRE(execs == (follow ? 2 : 0));
+        REQUIRE(exits == (follow ? 3 : 1));
+        REQUIRE(session.processes().size() == (follow ? 3 : 1));
+    }
+}
+
+TEST_CASE("Instruction cache invalidates overlapping decodes", "[disassembler]") {
+    instruction_cache cache;
+    cache.insert({ virt_addr{ 0x1000 }, "push %rbp", 1 });
+    cache.insert({ virt_addr{ 0x1001 }, "mov %rsp, %rbp", 3 });
+    cache.insert({ virt_addr{ 0x1004 }, "call 0x2000", 5,
+        instruction_kind::call, virt_addr{ 0x2000 } });
+    cache.insert({ virt_addr{ 0x1009 }, "ret", 1, instruction_kind::ret });
+
+    auto call = cache.find(virt_addr{ 0x1004 });
+    REQUIRE(call != nullptr);
+    REQUIRE(call->kind == instruction_kind::call);
+    REQUIRE(call->branch_target == virt_addr{ 0x2000 });
+    REQUIRE(cache.find(virt_addr{ 0x1005 }) == nullptr);
+    REQUIRE(cache.hits() == 1);
+    REQUIRE(cache.misses() == 1);
+
+    cache.invalidate(virt_addr{ 0x1006 }, 1);
+    REQUIRE(cache.size() == 3);
+    REQUIRE(cache.find(virt_addr{ 0x1004 }) == nullptr);
+    REQUIRE(cache.find(virt_addr{ 0x1001 }) != nullptr);
+    REQUIRE(cache.find(virt_addr{ 0x1009 }) != nullptr);
+
+    cache.invalidate(virt_addr{ 0x1000 }, 4);
+    REQUIRE(cache.size() == 1);
+}
+
 TEST_CASE("Syscall mapping works", "[syscall]") {
     REQUIRE(sdb::syscall_id_to_name(0) == "read");
     REQUIRE(sdb::syscall_name_to_id("read") == 0);
@@ -484,3 +865,1028 @@ TEST_CASE("Syscall catchpoints work", "[catchpoint]") {
 
     close(dev_null);
 }
+
+TEST_CASE("Seccomp filtered syscall catchpoints work", "[catchpoint]") {
+    auto dev_null = open("/dev/null", O_WRONLY);
+    auto write_syscall = sdb::syscall_name_to_id("write");
+    auto policy = sdb::syscall_catch_policy::catch_some({ write_syscall });
+    auto proc = process::launch("build/test/targets/anti_debugger", true,
+            dev_null, policy);
+    REQUIRE(proc->syscall_filter_active());
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == sdb::process_state::stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(reason.trap_reason == sdb::trap_type::syscall);
+    REQUIRE(reason.syscall_info->id == write_syscall);
+    REQUIRE(reason.syscall_info->entry == true);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == sdb::process_state::stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(reason.trap_reason == sdb::trap_type::syscall);
+    REQUIRE(reason.syscall_info->id == write_syscall);
+    REQUIRE(reason.syscall_info->entry == false);
+
+    proc->set_syscall_catch_policy(sdb::syscall_catch_policy::catch_none());
+    proc->resume();
+    reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == sdb::process_state::stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(reason.trap_reason != sdb::trap_type::syscall);
+
+    close(dev_null);
+}
+
+TEST_CASE("Syscall catchpoints work on attached processes", "[catchpoint]") {
+    auto target = process::launch(
+        "build/test/targets/syscall_endlessly", false);
+    auto proc = process::attach(target->pid());
+
+    auto getppid_syscall = sdb::syscall_name_to_id("getppid");
+    proc->set_syscall_catch_policy(
+        sdb::syscall_catch_policy::catch_some({ getppid_syscall }));
+    // The filter can't be installed after exec, so every syscall stops
+    // and sched_yield is skipped by us
+    REQUIRE(!proc->syscall_filter_active());
+
+    std::optional<bool> last_entry;
+    for (int i = 0; i < 6; ++i) {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+
+        REQUIRE(reason.reason == sdb::process_state::stopped);
+        REQUIRE(reason.trap_reason == sdb::trap_type::syscall);
+        REQUIRE(reason.syscall_info->id == getppid_syscall);
+        // Attaching may have stopped it inside a syscall, so which stop
+        // is the entry can't be told, only that they alternate
+        if (last_entry) REQUIRE(reason.syscall_info->entry != *last_entry);
+        last_entry = reason.syscall_info->entry;
+    }
+}
+
+TEST_CASE("Can poll for stops without blocking", "[process]") {
+    auto proc = process::launch("build/test/targets/run_endlessly");
+    proc->resume();
+
+    REQUIRE(!proc->try_wait());
+    REQUIRE(!proc->wait_for(std::chrono::milliseconds(20)));
+    REQUIRE(proc->state() == process_state::running);
+
+    kill(proc->pid(), SIGSTOP);
+    auto reason = proc->wait_for(std::chrono::seconds(5));
+    REQUIRE(reason);
+    REQUIRE(reason->reason == process_state::stopped);
+    REQUIRE(reason->info == SIGSTOP);
+
+    auto end = process::launch("build/test/targets/end_immediately");
+    auto fd = end->pidfd();
+    end->resume();
+    pollfd pfd{ fd, POLLIN, 0 };
+    REQUIRE(poll(&pfd, 1, 5000) == 1);
+    reason = end->try_wait();
+    REQUIRE(reason);
+    REQUIRE(reason->reason == process_state::exited);
+}
+
+TEST_CASE("Waiting leaves other children of the debugger alone",
+    "[process]") {
+    auto bystander = fork();
+    if (bystander == 0) _exit(7);
+    // Make sure its exit is ready to be collected before we wait
+    siginfo_t info{};
+    REQUIRE(waitid(P_PID, bystander, &info, WEXITED | WNOWAIT) == 0);
+
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/multi_threaded", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::stopped);
+    channel.read();
+
+    // The new threads' first stops are found although the bystander's exit
+    // is ahead of them
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(channel.read().size() == 4);
+
+    int status;
+    REQUIRE(waitpid(bystander, &status, 0) == bystander);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 7);
+}
+
+TEST_CASE("Profiler samples a running process", "[profile]") {
+    auto target = process::launch("build/test/targets/run_endlessly", false);
+    auto proc = process::seize(target->pid());
+    REQUIRE(proc->state() == process_state::running);
+
+    profiler prof(*proc);
+    prof.run(1000, std::chrono::milliseconds(200));
+    REQUIRE(prof.sample_count() > 10);
+    REQUIRE(proc->state() == process_state::running);
+
+    std::size_t total = 0;
+    for (auto& [frames, count] : prof.stacks()) {
+        REQUIRE(!frames.empty());
+        total += count;
+    }
+    REQUIRE(total == prof.sample_count());
+
+    std::ostringstream folded;
+    prof.write_folded(folded);
+    REQUIRE(std::regex_search(folded.str(),
+        std::regex(R"(^0x[0-9a-f]+(;0x[0-9a-f]+)* \d+\n)")));
+}
+
+TEST_CASE("Syscall tracer records into a ring buffer", "[syscall]") {
+    auto dev_null = open("/dev/null", O_WRONLY);
+    auto write_id = sdb::syscall_name_to_id("write");
+
+    {
+        auto proc = process::launch("build/test/targets/hello_sdb", true,
+            dev_null, syscall_catch_policy::catch_all());
+        syscall_tracer tracer(*proc, 4);
+        tracer.run();
+
+        REQUIRE(tracer.exit_reason());
+        REQUIRE(tracer.exit_reason()->reason == process_state::exited);
+
+        auto& records = tracer.records();
+        REQUIRE(records.size() == 4);
+        REQUIRE(records.dropped() > 0);
+        for (std::size_t i = 1; i < records.size(); ++i) {
+            REQUIRE(records[i - 1].timestamp <= records[i].timestamp);
+        }
+        REQUIRE(tracer.latencies().at(write_id).count == 1);
+    }
+    {
+        auto proc = process::launch("build/test/targets/hello_sdb", true,
+            dev_null, syscall_catch_policy::catch_some({ write_id }));
+        syscall_tracer tracer(*proc);
+        tracer.run();
+
+        auto& records = tracer.records();
+        REQUIRE(records.size() == 2);
+        REQUIRE(records[0].info.id == write_id);
+        REQUIRE(records[0].info.entry);
+        REQUIRE(!records[1].info.entry);
+        REQUIRE(records[1].info.ret == 12);
+
+        auto& histogram = tracer.latencies().at(write_id);
+        REQUIRE(histogram.count == 1);
+        REQUIRE(histogram.min == histogram.total);
+    }
+
+    close(dev_null);
+}
+
+TEST_CASE("Instruction traces match single stepping", "[trace]") {
+    auto path = std::filesystem::temp_directory_path() /
+        ("sdb_trace_" + std::to_string(getpid()));
+
+    std::vector<std::uint64_t> stepped;
+    {
+        auto proc = process::launch("build/test/targets/hello_sdb");
+        for (int i = 0; i < 200; ++i) {
+            proc->step_instruction();
+            stepped.push_back(proc->get_pc().addr());
+        }
+    }
+
+    auto proc = process::launch("build/test/targets/hello_sdb");
+    auto entry = proc->get_pc();
+    proc->create_breakpoint_site(entry).enable();
+    {
+        instruction_trace trace(path, /*record_registers=*/true);
+        auto reason = proc->trace_instructions(200, trace);
+        REQUIRE(reason.reason == process_state::stopped);
+        REQUIRE(reason.trap_reason == trap_type::single_step);
+        REQUIRE(trace.size() == 200);
+    }
+    REQUIRE(proc->breakpoint_sites().get_by_address(entry).is_enabled());
+
+    instruction_trace_reader reader(path);
+    REQUIRE(reader.has_registers());
+    REQUIRE(reader.size() == 200);
+    std::vector<std::uint64_t> traced;
+    instruction_trace_entry last;
+    while (auto entry = reader.next()) {
+        traced.push_back(entry->rip);
+        last = *entry;
+    }
+    REQUIRE(traced == stepped);
+
+    auto& regs = proc->get_registers();
+    REQUIRE(last.rip == proc->get_pc().addr());
+    REQUIRE(last.regs.rsp == regs.read_by_id_as<std::uint64_t>(register_id::rsp));
+    REQUIRE(last.regs.rax == regs.read_by_id_as<std::uint64_t>(register_id::rax));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Instruction traces can grow after being finished", "[trace]") {
+    auto path = std::filesystem::temp_directory_path() /
+        ("sdb_trace_finish_" + std::to_string(getpid()));
+
+    instruction_trace trace(path);
+    for (std::uint64_t rip = 0; rip < 100; ++rip) {
+        trace.append(rip * 0x1000);
+    }
+    trace.finish();
+    REQUIRE(instruction_trace_reader(path).size() == 100);
+
+    // Past the trimmed end of the file, but not of the mapping
+    for (std::uint64_t rip = 100; rip < 200; ++rip) {
+        trace.append(rip * 0x1000);
+    }
+    trace.finish();
+
+    instruction_trace_reader reader(path);
+    REQUIRE(reader.size() == 200);
+    std::uint64_t expected = 0;
+    while (auto entry = reader.next()) {
+        REQUIRE(entry->rip == expected);
+        expected += 0x1000;
+    }
+    REQUIRE(expected == 200 * 0x1000);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Instruction traces step on over stops nobody reports",
+    "[trace]") {
+    auto path = std::filesystem::temp_directory_path() /
+        ("sdb_trace_swallowed_" + std::to_string(getpid()));
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/watched_struct", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto values = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    // Its faults are handled and the thread resumed in the middle of the
+    // trace, which mustn't let the process run on
+    auto& watch = proc->create_watchpoint(values, stoppoint_mode::write, 4096);
+    watch.set_auto_continue(true);
+    watch.enable();
+    REQUIRE(!watch.is_hardware());
+
+    {
+        instruction_trace trace(path, /*record_registers=*/false);
+        auto reason = proc->trace_instructions(400, trace);
+        REQUIRE(reason.reason == process_state::stopped);
+        REQUIRE(reason.trap_reason == trap_type::single_step);
+        REQUIRE(trace.size() == 400);
+    }
+    REQUIRE(watch.hit_count() > 0);
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    auto sum = 1 + 2 + 0xcafe + 0xba5e;
+    REQUIRE(to_string_view(channel.read()) == std::to_string(sum));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Coverage removes each breakpoint on first hit", "[coverage]") {
+    auto path = "build/test/targets/nested_calls";
+    auto proc = process::launch(path);
+    auto entry = get_load_address(proc->pid(), get_entry_point_offset(path));
+
+    coverage cov(*proc);
+    cov.instrument();
+    auto& blocks = cov.blocks();
+    REQUIRE(blocks.size() > 10);
+    REQUIRE(std::is_sorted(begin(blocks), end(blocks)));
+    REQUIRE(std::find(begin(blocks), end(blocks), entry) != end(blocks));
+    REQUIRE(proc->breakpoint_sites().size() == blocks.size());
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(cov.record(reason));
+    REQUIRE(proc->get_pc() == entry);
+    REQUIRE(!proc->breakpoint_sites().contains_address(entry));
+
+    reason = cov.run();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(cov.covered_count() > 1);
+    REQUIRE(cov.covered_count() < blocks.size());
+
+    std::size_t covered = 0;
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        if (cov.is_covered(i)) ++covered;
+    }
+    REQUIRE(covered == cov.covered_count());
+    REQUIRE(cov.bitmap().size() == (blocks.size() + 7) / 8);
+    auto entry_index = std::find(begin(blocks), end(blocks), entry) -
+        begin(blocks);
+    REQUIRE(cov.is_covered(entry_index));
+}
+
+TEST_CASE("Conditional breakpoints only report matching hits", "[breakpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/repeated_calls", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto step = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    auto& regs = proc->get_registers();
+    regs.write_by_id(register_id::rdi, std::uint64_t{ 42 });
+    auto holds = [&](std::string_view source) {
+        return expression(source).evaluate(*proc, proc->pid()) != 0;
+    };
+    REQUIRE(holds("rdi == 42"));
+    REQUIRE(holds("edi == 0x2a && dil == 42"));
+    REQUIRE(holds("1 + 2 * 3 == 7 && (1 + 2) * 3 == 9"));
+    REQUIRE(holds("rdi > 40 && !(rdi >= 50) || [0]"));
+    REQUIRE(holds("-1 == ~0 && 1 << 4 == 16 && 7 % 4 == 3"));
+    REQUIRE(holds("mem64[rsp] == [rsp]"));
+    REQUIRE(!holds("rdi != 42 && [0]"));
+    REQUIRE_THROWS_AS(holds("[0] == 1"), error);
+    REQUIRE_THROWS_AS(expression("rdi =="), error);
+    REQUIRE_THROWS_AS(expression("xmm0 == 1"), error);
+    REQUIRE_THROWS_AS(expression("(rdi"), error);
+    // Deep nesting is refused before it can exhaust our own stack
+    REQUIRE_THROWS_AS(expression(std::string(100000, '(') + "1"), error);
+    REQUIRE_THROWS_AS(expression(std::string(100000, '-') + "1"), error);
+    REQUIRE_THROWS_AS(expression(std::string(100000, '[') + "rsp"), error);
+    REQUIRE(holds(std::string(60, '(') + "1" + std::string(60, ')')));
+
+    auto& site = proc->create_breakpoint_site(step);
+    site.set_condition(expression("rdi % 10 == 7"));
+    site.enable();
+
+    for (std::uint64_t expected : { 7, 17, 27 }) {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        REQUIRE(reason.trap_reason == trap_type::software_break);
+        REQUIRE(proc->get_pc() == step);
+        REQUIRE(regs.read_by_id_as<std::uint64_t>(register_id::rdi) ==
+            expected);
+    }
+
+    site.set_condition(expression("rdi == 1000"));
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "14850");
+}
+
+TEST_CASE("Ignored hits are counted but not reported", "[breakpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/repeated_calls", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto step = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+    auto& regs = proc->get_registers();
+    auto rdi = [&] {
+        return regs.read_by_id_as<std::uint64_t>(register_id::rdi);
+    };
+
+    auto& watch = proc->create_watchpoint(step, stoppoint_mode::execute, 1);
+    watch.set_ignore_count(4);
+    watch.enable();
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.trap_reason == trap_type::hardware_break);
+    REQUIRE(rdi() == 4);
+    REQUIRE(watch.hit_count() == 5);
+    REQUIRE(watch.ignore_count() == 0);
+    proc->watchpoints().remove_by_id(watch.id());
+
+    auto& site = proc->create_breakpoint_site(step);
+    site.set_ignore_count(44);
+    site.enable();
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.trap_reason == trap_type::software_break);
+    REQUIRE(rdi() == 49);
+    REQUIRE(site.hit_count() == 45);
+
+    // Hits which fail the condition don't use up the ignore count
+    site.set_condition(expression("(rdi & 1) == 0"));
+    site.set_ignore_count(10);
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(rdi() == 70);
+    REQUIRE(site.hit_count() == 56);
+
+    site.set_condition(std::nullopt);
+    site.set_ignore_count(1000);
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(site.hit_count() == 56 + 29);
+    REQUIRE(site.ignore_count() == 1000 - 29);
+}
+
+TEST_CASE("Ring buffers keep the most recent elements", "[ring_buffer]") {
+    REQUIRE_THROWS_AS(ring_buffer<int>(0), error);
+
+    ring_buffer<int> ring(4);
+    for (int i = 0; i < 3; ++i) ring.push(i);
+    REQUIRE(ring.size() == 3);
+    REQUIRE(ring[0] == 0);
+    REQUIRE(ring[2] == 2);
+    REQUIRE(ring.dropped() == 0);
+
+    for (int i = 3; i < 10; ++i) ring.push(i);
+    REQUIRE(ring.size() == 4);
+    REQUIRE(ring.dropped() == 6);
+    for (std::size_t i = 0; i < ring.size(); ++i) {
+        REQUIRE(ring[i] == 6 + static_cast<int>(i));
+    }
+
+    REQUIRE(ring.take() == std::vector<int>{ 6, 7, 8, 9 });
+    REQUIRE(ring.size() == 0);
+    REQUIRE(ring.dropped() == 0);
+
+    ring.push(10);
+    REQUIRE(ring[0] == 10);
+    ring.clear();
+    REQUIRE(ring.size() == 0);
+    REQUIRE(ring.capacity() == 4);
+}
+
+TEST_CASE("Tracepoints record captures without stopping", "[breakpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/repeated_calls", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto step = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    auto& site = proc->create_breakpoint_site(step);
+    sdb::trace_action action;
+    action.format = "step({})";
+    action.captures.emplace_back("rdi");
+    action.captures.emplace_back("mem64[0]");
+    site.set_trace_action(std::move(action));
+    site.enable();
+    REQUIRE(site.is_tracepoint());
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(site.hit_count() == 100);
+
+    auto hits = proc->take_tracepoint_hits();
+    REQUIRE(hits.size() == 100);
+    for (std::size_t i = 0; i < hits.size(); ++i) {
+        REQUIRE(hits[i].id == site.id());
+        REQUIRE(hits[i].values.size() == 2);
+        REQUIRE(hits[i].values[0] == i);
+        // Unreadable memory is recorded as a failed capture
+        REQUIRE(!hits[i].values[1]);
+    }
+    REQUIRE(proc->take_tracepoint_hits().empty());
+
+    auto output = channel.read();
+    REQUIRE(to_string_view(output).find("14850") != std::string_view::npos);
+
+    // Only the latest hits are kept until someone takes them
+    sdb::pipe bounded_channel(close_on_exec);
+    proc = process::launch("build/test/targets/repeated_calls", true,
+        bounded_channel.get_write());
+    bounded_channel.close_write();
+    proc->resume();
+    proc->wait_on_signal();
+    proc->set_tracepoint_log_capacity(10);
+
+    auto& bounded = proc->create_breakpoint_site(step);
+    sdb::trace_action bounded_action;
+    bounded_action.captures.emplace_back("rdi");
+    bounded.set_trace_action(std::move(bounded_action));
+    bounded.enable();
+    proc->resume();
+    REQUIRE(proc->wait_on_signal().reason == process_state::exited);
+
+    REQUIRE(proc->dropped_tracepoint_hits() == 90);
+    hits = proc->take_tracepoint_hits();
+    REQUIRE(hits.size() == 10);
+    for (std::size_t i = 0; i < hits.size(); ++i) {
+        REQUIRE(hits[i].values[0] == 90 + i);
+    }
+    REQUIRE(proc->dropped_tracepoint_hits() == 0);
+}
+
+TEST_CASE("Breakpoints are stepped over without being lifted",
+    "[breakpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/repeated_calls", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto step = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+    auto& regs = proc->get_registers();
+    auto read = [&](register_id id) {
+        return regs.read_by_id_as<std::uint64_t>(id);
+    };
+    auto is_int3 = [&](virt_addr address) {
+        return proc->read_memory(address, 1)[0] == std::byte{ 0xcc };
+    };
+
+    auto& entry = proc->create_breakpoint_site(step);
+    entry.enable();
+    proc->resume();
+    proc->wait_on_signal();
+    auto rsp = read(register_id::rsp);
+    auto return_address = virt_addr{
+        proc->read_memory_as<std::uint64_t>(virt_addr{ rsp }) };
+
+    // push %rbp, run from a copy
+    proc->step_instruction();
+    REQUIRE(is_int3(step));
+    REQUIRE(read(register_id::rsp) == rsp - 8);
+    REQUIRE(read(register_id::rip) > step.addr());
+    proc->breakpoint_sites().remove_by_id(entry.id());
+
+    disassembler disas(*proc);
+    auto body = disas.disassemble(16, step);
+    auto ret = std::find_if(begin(body), end(body),
+        [](auto& instr) { return instr.kind == instruction_kind::ret; });
+    REQUIRE(ret != end(body));
+    auto loop = disas.disassemble(16, return_address);
+    auto jump = std::find_if(begin(loop), end(loop), [](auto& instr) {
+        return instr.kind == instruction_kind::conditional_jump;
+    });
+    REQUIRE(jump != end(loop));
+    // Loads the printf format
+    auto load = std::find_if(jump, end(loop), [](auto& instr) {
+        return instr.text.find("(%rip)") != std::string::npos;
+    });
+    REQUIRE(load != end(loop));
+    auto call = return_address - 5;
+
+    for (auto address : { ret->address, jump->address, call, load->address }) {
+        proc->create_breakpoint_site(address).enable();
+    }
+
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(proc->get_pc() == ret->address);
+    proc->step_instruction();
+    REQUIRE(is_int3(ret->address));
+    REQUIRE(proc->get_pc() == return_address);
+
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(proc->get_pc() == jump->address);
+    proc->step_instruction();
+    REQUIRE(proc->get_pc() == *jump->branch_target);
+
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(proc->get_pc() == call);
+    proc->step_instruction();
+    REQUIRE(proc->get_pc() == step);
+    rsp = read(register_id::rsp);
+    REQUIRE(proc->read_memory_as<std::uint64_t>(virt_addr{ rsp }) ==
+        return_address.addr());
+
+    while (proc->get_pc() != load->address) {
+        proc->resume();
+        proc->wait_on_signal();
+    }
+    proc->step_instruction();
+    auto format = proc->read_memory(virt_addr{ read(register_id::rax) }, 3);
+    REQUIRE(to_string_view(format) == std::string_view("%d\0", 3));
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "14850");
+}
+
+TEST_CASE("Software watchpoints cover what debug registers can't",
+    "[watchpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/watched_struct", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto values = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    // Never written, but they use up the debug registers
+    for (auto i = 100; i < 104; ++i) {
+        auto& point = proc->create_watchpoint(
+            values + i * 8, stoppoint_mode::write, 8);
+        point.enable();
+        REQUIRE(point.is_hardware());
+    }
+    // Until it is hit, this one is caught through page protection
+    auto& read = proc->create_watchpoint(
+        values + 104 * 8, stoppoint_mode::read_write, 8);
+    read.enable();
+    REQUIRE(read.is_hardware());
+
+    auto& watch = proc->create_watchpoint(values, stoppoint_mode::write, 4096);
+    watch.enable();
+    REQUIRE(!watch.is_hardware());
+
+    // Writes to the neighbouring fields fault too, but aren't reported
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(!proc->hardware_stoppoints().is_resident(
+        hardware_stoppoint_id{ std::in_place_index<1>, read.id() }));
+    REQUIRE(reason.trap_reason == trap_type::software_watch);
+    REQUIRE(*reason.watchpoint_id == watch.id());
+    REQUIRE(watch.data_address() == values + 10 * 8);
+    REQUIRE(watch.previous_data() == 0);
+    REQUIRE(watch.data() == 0xcafe);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(*reason.watchpoint_id == watch.id());
+    REQUIRE(watch.data_address() == values + 511 * 8);
+    REQUIRE(watch.data() == 0xba5e);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.trap_reason == trap_type::software_watch);
+    REQUIRE(*reason.watchpoint_id == read.id());
+    REQUIRE(read.hit_count() == 1);
+
+    proc->watchpoints().remove_by_id(read.id());
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(watch.hit_count() == 2);
+    REQUIRE(to_string_view(channel.read()) == "99679");
+}
+
+TEST_CASE("Software watchpoints see the kernel write to them",
+    "[watchpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/watched_read", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto buffer = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    auto& watch = proc->create_watchpoint(buffer, stoppoint_mode::write, 64);
+    watch.enable();
+    REQUIRE(!watch.is_hardware());
+
+    // read(2) fails on the protected page and is run again without it
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.trap_reason == trap_type::software_watch);
+    REQUIRE(*reason.watchpoint_id == watch.id());
+    REQUIRE(watch.hit_count() == 1);
+    REQUIRE(watch.data() == from_bytes<std::uint64_t>(
+        proc->read_memory(buffer, 8).data()));
+
+    proc->resume();
+    REQUIRE(proc->wait_on_signal().reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "5 hello");
+}
+
+TEST_CASE("Debug registers are packed and shared out by hits",
+    "[watchpoint]") {
+    debug_register_allocator allocator;
+    auto watch = [](watchpoint::id_type id) {
+        return hardware_stoppoint_id{ std::in_place_index<1>, id };
+    };
+    auto add = [&](watchpoint::id_type id, std::uint64_t address,
+        stoppoint_mode mode, std::size_t size) {
+        allocator.add({ watch(id), virt_addr{ address }, mode, size });
+    };
+
+    // Halves of an aligned 8 bytes share a register, but reads don't share
+    // with writes, and 0x2002-0x2006 isn't aligned
+    add(1, 0x1000, stoppoint_mode::write, 4);
+    add(2, 0x1004, stoppoint_mode::write, 4);
+    add(3, 0x1004, stoppoint_mode::read_write, 4);
+    add(4, 0x2002, stoppoint_mode::write, 2);
+    add(5, 0x2004, stoppoint_mode::write, 2);
+    auto site = hardware_stoppoint_id{ std::in_place_index<0>, 1 };
+    allocator.add({ site, virt_addr{ 0x3000 }, stoppoint_mode::execute, 1 });
+    add(6, 0x3000, stoppoint_mode::execute, 1);
+
+    REQUIRE(allocator.assign());
+    auto& slots = allocator.slots();
+    REQUIRE(slots[0]->address == virt_addr{ 0x1000 });
+    REQUIRE(slots[0]->size == 8);
+    REQUIRE(slots[0]->owners == std::vector{ watch(1), watch(2) });
+    REQUIRE(slots[1]->owners == std::vector{ watch(3) });
+    REQUIRE(slots[2]->owners == std::vector{ watch(4) });
+    REQUIRE(slots[3]->owners == std::vector{ watch(5) });
+    REQUIRE(allocator.non_resident().size() == 2);
+    REQUIRE(!allocator.is_resident(site));
+
+    // The execute slot takes the register of the youngest of the others
+    allocator.record_hit(watch(6));
+    REQUIRE(allocator.assign());
+    REQUIRE(slots[0]->owners == std::vector{ watch(1), watch(2) });
+    REQUIRE(slots[3]->mode == stoppoint_mode::execute);
+    REQUIRE(slots[3]->owners == std::vector{ site, watch(6) });
+    REQUIRE(!allocator.is_resident(watch(5)));
+    REQUIRE(!allocator.assign());
+
+    // Taking a register from a stoppoint which is hit takes more than twice
+    // as many hits
+    for (auto id : { 1, 3, 4, 6 }) allocator.record_hit(watch(id));
+    allocator.assign();
+    allocator.record_hit(watch(5));
+    REQUIRE(!allocator.assign());
+    for (auto i = 0; i < 3; ++i) allocator.record_hit(watch(5));
+    REQUIRE(allocator.assign());
+    REQUIRE(allocator.is_resident(watch(5)));
+    REQUIRE(!allocator.is_resident(watch(4)));
+
+    // Alone, the other half of the first slot has had no hits to keep it
+    allocator.remove(watch(1));
+    REQUIRE(allocator.assign());
+    REQUIRE(allocator.is_resident(watch(4)));
+    REQUIRE(allocator.non_resident().size() == 1);
+    REQUIRE(!allocator.is_resident(watch(2)));
+}
+
+TEST_CASE("Adjacent read watchpoints each count their hits",
+    "[watchpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/watched_struct", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto values = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    // Halves of values[10], which one 8 byte write and read both touch
+    auto& low = proc->create_watchpoint(
+        values + 10 * 8, stoppoint_mode::read_write, 4);
+    auto& high = proc->create_watchpoint(
+        values + 10 * 8 + 4, stoppoint_mode::read_write, 4);
+    low.enable();
+    high.enable();
+
+    for (int i = 0; i < 2; ++i) {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        REQUIRE(reason.trap_reason == trap_type::hardware_break);
+        auto hits = proc->current_hardware_stoppoints();
+        REQUIRE(hits.size() == 2);
+        REQUIRE(std::get<1>(hits[0]) != std::get<1>(hits[1]));
+    }
+    REQUIRE(low.hit_count() == 2);
+    REQUIRE(high.hit_count() == 2);
+    REQUIRE(low.history().size() == 2);
+    REQUIRE(high.history().size() == 2);
+
+    proc->resume();
+    REQUIRE(proc->wait_on_signal().reason == process_state::exited);
+}
+
+TEST_CASE("Hardware breakpoints outnumber the debug registers",
+    "[breakpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/repeated_calls", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto step = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+    auto code = proc->read_memory(step, 16);
+
+    disassembler disas(*proc);
+    std::vector<breakpoint_site*> sites;
+    for (auto& instr : disas.disassemble(6, step)) {
+        sites.push_back(&proc->create_breakpoint_site(instr.address, true));
+        sites.back()->enable();
+    }
+
+    // Those without a register stop through the protection of their page,
+    // and the code is never changed
+    std::size_t stops = 0;
+    std::size_t hardware_stops = 0;
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    while (reason.reason == process_state::stopped) {
+        REQUIRE(proc->get_pc() == sites[stops % sites.size()]->address());
+        REQUIRE(proc->read_memory(step, 16) == code);
+        if (reason.trap_reason == trap_type::hardware_break) ++hardware_stops;
+        ++stops;
+        proc->resume();
+        reason = proc->wait_on_signal();
+    }
+
+    REQUIRE(stops == 600);
+    REQUIRE(hardware_stops == 400);
+    for (auto site : sites) {
+        REQUIRE(site->hit_count() == 100);
+    }
+    REQUIRE(to_string_view(channel.read()) == "14850");
+}
+
+TEST_CASE("Watchpoints keep a history of their hits", "[watchpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/repeated_calls", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto step = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    auto& watch = proc->create_watchpoint(step, stoppoint_mode::execute, 1);
+    watch.set_history_capacity(64);
+    watch.set_auto_continue(true);
+    watch.enable();
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "14850");
+
+    auto& history = watch.history();
+    REQUIRE(watch.hit_count() == 100);
+    REQUIRE(history.size() == 64);
+    REQUIRE(history.dropped() == 36);
+    for (std::size_t i = 0; i < history.size(); ++i) {
+        REQUIRE(history[i].rip == step.addr());
+        if (i > 0) {
+            REQUIRE(history[i].timestamp >= history[i - 1].timestamp);
+        }
+    }
+
+    sdb::pipe struct_channel(close_on_exec);
+    proc = process::launch("build/test/targets/watched_struct", true,
+        struct_channel.get_write());
+    struct_channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto values = virt_addr(
+        from_bytes<std::uint64_t>(struct_channel.read().data()));
+
+    auto& data_watch = proc->create_watchpoint(
+        values + 10 * 8, stoppoint_mode::write, 8);
+    data_watch.set_auto_continue(true);
+    data_watch.enable();
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::exited);
+    REQUIRE(to_string_view(struct_channel.read()) == "99679");
+
+    auto& data_history = data_watch.history();
+    REQUIRE(data_history.size() == 1);
+    REQUIRE(data_history[0].old_value == 0);
+    REQUIRE(data_history[0].new_value == 0xcafe);
+    REQUIRE(data_history[0].rip != 0);
+}
+
+TEST_CASE("Latency tracer times calls without stopping", "[latency]") {
+    hdr_histogram values;
+    for (std::uint64_t i = 1; i <= 100000; ++i) values.add(i);
+    REQUIRE(values.count() == 100000);
+    REQUIRE(values.min() == 1);
+    REQUIRE(values.max() == 100000);
+    REQUIRE(values.mean() == 50000);
+    // Buckets are within 1/32 of their values
+    for (auto fraction : { 0.5, 0.9, 0.99 }) {
+        auto exact = fraction * 100000;
+        REQUIRE(values.percentile(fraction) >= exact);
+        REQUIRE(values.percentile(fraction) <= exact * 33 / 32);
+    }
+    REQUIRE(values.percentile(1) == 100000);
+    std::uint64_t total = 0;
+    for (auto& bucket : values.buckets()) {
+        REQUIRE(bucket.low <= bucket.high);
+        total += bucket.count;
+    }
+    REQUIRE(total == 100000);
+
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/repeated_calls", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto step = virt_addr(from_bytes<std::uint64_t>(channel.read().data()));
+
+    latency_tracer tracer(*proc);
+    tracer.trace(step);
+    tracer.run();
+    REQUIRE(tracer.exit_reason());
+    REQUIRE(tracer.exit_reason()->reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "14850");
+
+    auto& threads = tracer.latencies().at(step);
+    REQUIRE(threads.size() == 1);
+    auto& calls = threads.at(proc->pid());
+    REQUIRE(calls.count() == 100);
+    REQUIRE(calls.min() <= calls.percentile(0.5));
+    REQUIRE(calls.percentile(0.5) <= calls.max());
+    // Return breakpoints are gone once their calls return
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+}
+
+TEST_CASE("Checkpoints can be restarted from repeatedly", "[checkpoint]") {
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("build/test/targets/checkpointed", true,
+        channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto addresses = channel.read();
+    auto counter = virt_addr(from_bytes<std::uint64_t>(addresses.data()));
+    auto bump = virt_addr(from_bytes<std::uint64_t>(addresses.data() + 8));
+    REQUIRE(proc->read_memory_as<int>(counter) == 1);
+
+    auto original_pid = proc->pid();
+    auto id = proc->checkpoint();
+    auto checkpoints = proc->checkpoints();
+    REQUIRE(checkpoints.size() == 1);
+    REQUIRE(checkpoints[0].id == id);
+    REQUIRE(checkpoints[0].pid != original_pid);
+    REQUIRE(checkpoints[0].pc == proc->get_pc());
+
+    for (int i = 0; i < 2; ++i) {
+        proc->resume();
+        REQUIRE(proc->wait_on_signal().info == SIGTRAP);
+    }
+    // Breakpoints set since the checkpoint carry over into the restart
+    auto& site = proc->create_breakpoint_site(bump);
+    site.enable();
+    proc->resume();
+    REQUIRE(proc->wait_on_signal().reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "3");
+
+    proc->restart(id);
+    REQUIRE(proc->pid() != original_pid);
+    REQUIRE(proc->read_memory_as<int>(counter) == 1);
+    REQUIRE(proc->get_pc() == checkpoints[0].pc);
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.trap_reason == trap_type::software_break);
+    REQUIRE(proc->get_pc() == bump);
+    site.disable();
+    proc->resume();
+    REQUIRE(proc->wait_on_signal().info == SIGTRAP);
+    REQUIRE(proc->read_memory_as<int>(counter) == 2);
+
+    proc->restart(id);
+    REQUIRE(proc->read_memory_as<int>(counter) == 1);
+    for (int i = 0; i < 2; ++i) {
+        proc->resume();
+        REQUIRE(proc->wait_on_signal().info == SIGTRAP);
+    }
+    proc->resume();
+    REQUIRE(proc->wait_on_signal().reason == process_state::exited);
+    REQUIRE(to_string_view(channel.read()) == "3");
+
+    proc->delete_checkpoint(id);
+    REQUIRE(proc->checkpoints().empty());
+    REQUIRE_THROWS_AS(proc->restart(id), error);
+
+    // Processes we attached to aren't ours to kill on restart
+    auto target = process::launch("build/test/targets/run_endlessly", false);
+    auto attached = process::attach(target->pid());
+    REQUIRE_THROWS_AS(attached->checkpoint(), error);
+    REQUIRE(attached->checkpoints().empty());
+}
@@ -3,6 +3,10 @@
 #include <libsdb/types.hpp>
 #include <libsdb/disassembler.hpp>
 #include <libsdb/syscalls.hpp>
+#include <libsdb/profiler.hpp>
+#include <libsdb/syscall_tracer.hpp>
+#include <libsdb/coverage.hpp>
+#include <libsdb/latency_tracer.hpp>
 
 #include <iostream>
 #include <unistd.h>
@@ -15,9 +19,11 @@
 #include <sstream>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
+#include <fmt/args.h>
 #include <libsdb/parse.hpp>
 #include <array>
 #include <csignal>
+#include <fstream>
 
 namespace {
     sdb::process* g_sdb_process = nullptr;
@@ -37,6 +43,17 @@ namespace {
         return out;
     }
 
+    // Arguments were split on spaces, which expressions may contain
+    std::string join_args(std::vector<std::string>::const_iterator first,
+        std::vector<std::string>::const_iterator last) {
+        std::string joined;
+        for (auto it = first; it != last; ++it) {
+            if (it != first) joined += ' ';
+            joined += *it;
+        }
+        return joined;
+    }
+
     bool is_prefix(std::string_view str, std::string_view of) {
         if (str.size() > of.size()) return false;
         return std::equal(str.begin(), str.end(), of.begin());
@@ -51,8 +68,14 @@ memory          - Commands for operating on memory
 disassemble     - Disassemble machine code to assembly
 register        - Commands for operating on registers
 step            - Step over a single instruction
+next            - Step over a single instruction, running over calls
+finish          - Run until the current function returns
 watchpoint      - Commands for operating on watchpoints
+tracepoint      - Commands for operating on tracepoints
 catchpoint      - Commands for operating on catchpoints
+thread          - Commands for operating on threads
+checkpoint      - Commands for operating on checkpoints
+restart         - Restart from a checkpoint
 exit            - Exit the debugger
 )";
         }
@@ -72,6 +95,12 @@ disable <id>
 enable <id>
 set <address>
 set <address> -h
+set <address> [-h] if <condition>
+condition <id> [<condition>]
+ignore <id> <count>
+
+Conditions are C-like expressions over registers, mem8[addr] to
+mem64[addr] and integers, e.g. rdi == 42 && mem32[rsi + 8] != 0
 )";
         }
         else if (is_prefix(args[1], "memory")) {
@@ -94,6 +123,23 @@ delete <id>
 disable <id>
 enable <id>
 set <address> <write|rw|execute> <size>
+ignore <id> <count>
+history <id> [<count>]
+autocontinue <id> <on|off>
+
+Every trigger records rip and the old and new value. With autocontinue
+on, triggers are only recorded and the process doesn't stop
+)";
+        }
+        else if (is_prefix(args[1], "tracepoint")) {
+            std::cerr << R"(Available commands:
+list
+delete <id>
+set <address> "<format>" <expression>...
+
+Each hit records the expressions and resumes without stopping. Hits are
+printed with the format, in fmt syntax, at the next stop, e.g.
+tracepoint set 0x401136 "step({}) from {:#x}" rdi [rsp]
 )";
         }
         else if (is_prefix(args[1], "catchpoint")) {
@@ -101,6 +147,28 @@ set <address> <write|rw|execute> <size>
 syscall
 syscall none
 syscall <list of syscall IDs or names>
+
+Catchpoints stop on every syscall and skip those not in the list. Only
+`sdb trace -e` on a program it launches has the kernel skip them instead,
+which is much faster; attached processes never do
+)";
+        }
+        else if (is_prefix(args[1], "thread")) {
+            std::cerr << R"(Available commands:
+list
+select <thread id>
+mode <all-stop|non-stop>
+)";
+        }
+        else if (is_prefix(args[1], "checkpoint")) {
+            std::cerr << R"(Available commands:
+(no arguments)
+list
+delete <id>
+
+A checkpoint is a forked copy of the stopped process, parked until
+"restart <id>" kills the process and carries on in a new copy of it.
+Only single-threaded processes which sdb launched can be checkpointed
 )";
         }
         else {
@@ -219,6 +287,24 @@ syscall <list of syscall IDs or names>
         }
     }
 
+    template <class Stoppoint>
+    std::string describe_ignore_count(const Stoppoint& point) {
+        if (point.ignore_count() == 0) return "";
+        return fmt::format(", ignoring next {}", point.ignore_count());
+    }
+
+    template <class Stoppoint>
+    void handle_ignore_command(
+        Stoppoint& point, const std::vector<std::string>& args) {
+        auto count = args.size() == 4 ?
+            sdb::to_integral<std::uint64_t>(args[3]) : std::nullopt;
+        if (!count) {
+            std::cerr << "Command expects a count\n";
+            return;
+        }
+        point.set_ignore_count(*count);
+    }
+
     void handle_breakpoint_command(sdb::process& process, 
         const std::vector<std::string>& args) {
         if (args.size() < 2) {
@@ -235,10 +321,13 @@ syscall <list of syscall IDs or names>
             else {
                 fmt::print("Current breakpoints:\n");
                 process.breakpoint_sites().for_each([](auto& site) {
-                    if (site.is_internal()) return;
-                    fmt::print("{}: address = {:#x}, {}\n",
+                    if (site.is_internal() or site.is_tracepoint()) return;
+                    fmt::print("{}: address = {:#x}, {}, hits = {}{}{}\n",
                         site.id(), site.address().addr(), 
-                        site.is_enabled() ? "enabled" : "disabled");
+                        site.is_enabled() ? "enabled" : "disabled",
+                        site.hit_count(), describe_ignore_count(site),
+                        site.condition() ?
+                            ", if " + site.condition()->source() : "");
                 });
             }
             return;
@@ -259,9 +348,20 @@ syscall <list of syscall IDs or names>
                 return;
             }
 
-            bool hardware = args.size() == 4 and args[3] == "-h";
-            process.create_breakpoint_site(
-                sdb::virt_addr{ *address }, hardware).enable();
+            auto condition_start = std::find(begin(args), end(args), "if");
+            bool hardware = std::find(begin(args) + 3, condition_start, "-h")
+                != condition_start;
+            // Compiled before the site exists so a bad condition leaves
+            // nothing behind
+            std::optional<sdb::expression> condition;
+            if (condition_start != end(args)) {
+                condition.emplace(join_args(condition_start + 1, end(args)));
+            }
+
+            auto& site = process.create_breakpoint_site(
+                sdb::virt_addr{ *address }, hardware);
+            site.set_condition(std::move(condition));
+            site.enable();
             return;
         }
 
@@ -271,7 +371,19 @@ syscall <list of syscall IDs or names>
             return;
         }
 
-        if (is_prefix(command, "enable")) {
+        if (is_prefix(command, "ignore")) {
+            handle_ignore_command(
+                process.breakpoint_sites().get_by_id(*id), args);
+        } else if (is_prefix(command, "condition")) {
+            auto& site = process.breakpoint_sites().get_by_id(*id);
+            if (args.size() == 3) {
+                site.set_condition(std::nullopt);
+            }
+            else {
+                site.set_condition(sdb::expression(
+                    join_args(begin(args) + 3, end(args))));
+            }
+        } else if (is_prefix(command, "enable")) {
             process.breakpoint_sites().get_by_id(*id).enable();
         } else if (is_prefix(command, "disable")) {
             process.breakpoint_sites().get_by_id(*id).disable();
@@ -394,10 +506,15 @@ syscall <list of syscall IDs or names>
         else {
             fmt::print("Current watchpoints:\n");
             process.watchpoints().for_each([&](auto& point) {
-                fmt::print("{}: address = {:#x}, mode = {}, size = {}, {}\n",
+                auto state = !point.is_enabled() ? "disabled" :
+                    point.is_hardware() ? "enabled" : "enabled (software)";
+                fmt::print(
+                    "{}: address = {:#x}, mode = {}, size = {}, {}, "
+                    "hits = {}{}{}\n",
                     point.id(), point.address().addr(),
                     stoppoint_mode_to_string(point.mode()), point.size(),
-                    point.is_enabled() ? "enabled" : "disabled");
+                    state, point.hit_count(), describe_ignore_count(point),
+                    point.auto_continues() ? ", auto-continue" : "");
             });
         }
     }
@@ -427,8 +544,45 @@ syscall <list of syscall IDs or names>
         else if (mode_text == "rw") mode = sdb::stoppoint_mode::read_write;
         else if (mode_text == "execute") mode = sdb::stoppoint_mode::execute;
 
-        process.create_watchpoint(
-            sdb::virt_addr{ *address }, mode, *size).enable();
+        auto& point = process.create_watchpoint(
+            sdb::virt_addr{ *address }, mode, *size);
+        point.enable();
+        if (!point.is_hardware()) {
+            fmt::print("Watchpoint {} is a software watchpoint. Its pages "
+                "are protected, which slows the process, and syscalls are "
+                "traced to rerun those which fault on them\n", point.id());
+        }
+    }
+
+    void handle_watchpoint_history(const sdb::watchpoint& point,
+        const std::vector<std::string>& args)
+    {
+        auto& history = point.history();
+        auto count = history.size();
+        if (args.size() == 4) {
+            auto requested = sdb::to_integral<std::size_t>(args[3]);
+            if (!requested) {
+                std::cerr << "Command expects a count\n";
+                return;
+            }
+            count = std::min(count, *requested);
+        }
+        if (count == 0) {
+            fmt::print("No hits recorded\n");
+            return;
+        }
+
+        // The most recent hits, timed from the first of those shown
+        auto first = history.size() - count;
+        auto start = history[first].timestamp;
+        for (auto i = first; i < history.size(); ++i) {
+            auto& hit = history[i];
+            fmt::print("+{}ns: rip = {:#x}, {:#x} -> {:#x}\n",
+                hit.timestamp - start, hit.rip, hit.old_value, hit.new_value);
+        }
+        if (history.dropped() > 0) {
+            fmt::print("{} older hits dropped\n", history.dropped());
+        }
     }
 
     void handle_watchpoint_command(sdb::process& process,
@@ -462,7 +616,22 @@ syscall <list of syscall IDs or names>
             return;
         }
 
-        if (is_prefix(command, "enable")) {
+        if (is_prefix(command, "ignore")) {
+            handle_ignore_command(process.watchpoints().get_by_id(*id), args);
+        }
+        else if (is_prefix(command, "history")) {
+            handle_watchpoint_history(
+                process.watchpoints().get_by_id(*id), args);
+        }
+        else if (is_prefix(command, "autocontinue")) {
+            if (args.size() != 4 or (args[3] != "on" and args[3] != "off")) {
+                print_help({ "help", "watchpoint" });
+                return;
+            }
+            process.watchpoints().get_by_id(*id).set_auto_continue(
+                args[3] == "on");
+        }
+        else if (is_prefix(command, "enable")) {
             process.watchpoints().get_by_id(*id).enable();
         }
         else if (is_prefix(command, "disable")) {
@@ -473,6 +642,24 @@ syscall <list of syscall IDs or names>
         }
     }
 
+    std::string describe_watchpoint_hit(const sdb::watchpoint& point) {
+        std::string message = " ";
+        message += fmt::format(" (watchpoint {})", point.id());
+
+        // Regions wider than the value shown say where it was read
+        if (point.size() > 8) {
+            message += fmt::format("\nAt: {:#x}", point.data_address().addr());
+        }
+        if (point.data() == point.previous_data()) {
+            message += fmt::format("\nValue: {:#x}", point.data());
+        }
+        else {
+            message += fmt::format("\nOld value: {:#x}\nNew value: {:#x}",
+                point.previous_data(), point.data());
+        }
+        return message;
+    }
+
     std::string get_sigtrap_info(
         const sdb::process& process, sdb::stop_reason reason)
     {
@@ -483,30 +670,38 @@ syscall <list of syscall IDs or names>
         }
 
         if (reason.trap_reason == sdb::trap_type::hardware_break) {
-            auto id = process.get_current_hardware_stoppoint();
-
-            if (id.index() == 0) {
-                return fmt::format(" (breakpoint {})", std::get<0>(id));
-            }
-
-            std::string message = " ";
-            auto& point = process.watchpoints().get_by_id(std::get<1>(id));
-            message += fmt::format(" (watchpoint {})", point.id());
-
-            if (point.data() == point.previous_data()) {
-                message += fmt::format("\nValue: {:#x}", point.data());
-            }
-            else {
-                message += fmt::format("\nOld value: {:#x}\nNew value: {:#x}",
-                    point.previous_data(), point.data());
+            // One access can hit several stoppoints
+            std::string message;
+            for (auto id : process.current_hardware_stoppoints()) {
+                if (!message.empty()) message += "\n";
+                if (id.index() == 0) {
+                    message += fmt::format(" (breakpoint {})", std::get<0>(id));
+                }
+                else {
+                    message += describe_watchpoint_hit(
+                        process.watchpoints().get_by_id(std::get<1>(id)));
+                }
             }
             return message;
         }
 
+        if (reason.trap_reason == sdb::trap_type::software_watch) {
+            return describe_watchpoint_hit(
+                process.watchpoints().get_by_id(*reason.watchpoint_id));
+        }
+
         if (reason.trap_reason == sdb::trap_type::single_step) {
             return " (single step)";
         }
 
+        if (reason.trap_reason == sdb::trap_type::fork) {
+            return fmt::format(" (forked process {})", *reason.child_pid);
+        }
+
+        if (reason.trap_reason == sdb::trap_type::exec) {
+            return " (exec)";
+        }
+
         if (reason.trap_reason == sdb::trap_type::syscall) {
             const auto& info = *reason.syscall_info;
             std::string message;
@@ -539,7 +734,10 @@ syscall <list of syscall IDs or names>
                     sigabbrev_np(reason.info));
                 break;
             case sdb::process_state::stopped:
-                message = fmt::format("stopped with signal {} at {:#x}",
+                if (process.threads().size() > 1) {
+                    message = fmt::format("thread {} ", reason.tid);
+                }
+                message += fmt::format("stopped with signal {} at {:#x}",
                     sigabbrev_np(reason.info), process.get_pc().addr());
                 if (reason.info == SIGTRAP) {
                     message += get_sigtrap_info(process, reason);
@@ -549,13 +747,161 @@ syscall <list of syscall IDs or names>
         fmt::print("Process {} {}\n", process.pid(), message);
     }
 
+    std::optional<std::string> format_tracepoint(const std::string& format,
+        const std::vector<std::optional<std::uint64_t>>& values) {
+        fmt::dynamic_format_arg_store<fmt::format_context> store;
+        for (auto& value : values) {
+            if (value) store.push_back(*value);
+            else store.push_back("<error>");
+        }
+        try {
+            return fmt::vformat(format, store);
+        }
+        catch (const fmt::format_error&) {
+            return std::nullopt;
+        }
+    }
+
+    void print_tracepoint_hits(sdb::process& process) {
+        if (auto dropped = process.dropped_tracepoint_hits()) {
+            fmt::print("({} earlier tracepoint hits dropped)\n", dropped);
+        }
+        for (auto& hit : process.take_tracepoint_hits()) {
+            if (!process.breakpoint_sites().contains_id(hit.id)) continue;
+            auto& site = process.breakpoint_sites().get_by_id(hit.id);
+            auto& format = site.get_trace_action()->format;
+
+            auto text = format_tracepoint(format, hit.values);
+            if (!text) {
+                // Values which don't suit the format are shown raw
+                std::vector<std::string> values;
+                for (auto& value : hit.values) {
+                    values.push_back(value ?
+                        fmt::format("{:#x}", *value) : "<error>");
+                }
+                text = fmt::format("{} ({})", format, fmt::join(values, ", "));
+            }
+            fmt::print("[tracepoint {}, thread {}] {}\n",
+                hit.id, hit.tid, *text);
+        }
+    }
+
     void handle_stop(sdb::process& process, sdb::stop_reason reason) {
+        print_tracepoint_hits(process);
         print_stop_reason(process, reason);
         if (reason.reason == sdb::process_state::stopped) {
             print_disassembly(process, process.get_pc(), 5);
         }
     }
 
+    // Splits the captures after the format on spaces outside brackets, so
+    // that mem64[rsi + 8] stays whole
+    std::vector<std::string> split_captures(std::string_view text) {
+        std::vector<std::string> captures;
+        std::string current;
+        int depth = 0;
+        for (auto c : text) {
+            if (c == '[' or c == '(') ++depth;
+            if (c == ']' or c == ')') --depth;
+            if (c == ' ' and depth == 0) {
+                if (!current.empty()) captures.push_back(std::move(current));
+                current.clear();
+            }
+            else {
+                current += c;
+            }
+        }
+        if (!current.empty()) captures.push_back(std::move(current));
+        return captures;
+    }
+
+    void handle_tracepoint_set(sdb::process& process,
+        const std::vector<std::string>& args) {
+        if (args.size() < 4) {
+            print_help({ "help", "tracepoint" });
+            return;
+        }
+        auto address = sdb::to_integral<std::uint64_t>(args[2], 16);
+        auto rest = join_args(begin(args) + 3, end(args));
+        auto close = rest.find('"', 1);
+        if (!address or rest[0] != '"' or close == std::string::npos) {
+            print_help({ "help", "tracepoint" });
+            return;
+        }
+
+        sdb::trace_action action;
+        action.format = rest.substr(1, close - 1);
+        for (auto& capture : split_captures(rest.substr(close + 1))) {
+            action.captures.emplace_back(capture);
+        }
+        std::vector<std::optional<std::uint64_t>> zeros(
+            action.captures.size(), 0);
+        if (!format_tracepoint(action.format, zeros)) {
+            std::cerr << "Format doesn't match the captures\n";
+            return;
+        }
+
+        auto& site = process.create_breakpoint_site(
+            sdb::virt_addr{ *address });
+        site.set_trace_action(std::move(action));
+        site.enable();
+        fmt::print("Tracepoint {} set at {:#x}\n", site.id(), *address);
+    }
+
+    void handle_tracepoint_command(sdb::process& process,
+        const std::vector<std::string>& args) {
+        if (args.size() < 2) {
+            print_help({ "help", "tracepoint" });
+            return;
+        }
+        auto command = args[1];
+
+        if (is_prefix(command, "list")) {
+            bool any = false;
+            process.breakpoint_sites().for_each([&](auto& site) {
+                if (!site.is_tracepoint()) return;
+                auto& action = *site.get_trace_action();
+                std::vector<std::string_view> captures;
+                for (auto& capture : action.captures) {
+                    captures.push_back(capture.source());
+                }
+                fmt::print("{}: address = {:#x}, hits = {}, \"{}\" {}\n",
+                    site.id(), site.address().addr(), site.hit_count(),
+                    action.format, fmt::join(captures, " "));
+                any = true;
+            });
+            if (!any) fmt::print("No tracepoints set\n");
+        }
+        else if (is_prefix(command, "set")) {
+            handle_tracepoint_set(process, args);
+        }
+        else if (is_prefix(command, "delete") and args.size() == 3) {
+            auto id = sdb::to_integral<sdb::breakpoint_site::id_type>(args[2]);
+            if (!id or !process.breakpoint_sites().contains_id(*id) or
+                !process.breakpoint_sites().get_by_id(*id).is_tracepoint()) {
+                std::cerr << "Command expects tracepoint id\n";
+                return;
+            }
+            process.breakpoint_sites().remove_by_id(*id);
+        }
+        else {
+            print_help({ "help", "tracepoint" });
+        }
+    }
+
+    std::vector<int> parse_syscall_list(std::string_view list) {
+        auto syscalls = split(list, ',');
+        std::vector<int> ids;
+        std::transform(begin(syscalls), end(syscalls),
+            std::back_inserter(ids),
+            [](auto& syscall) {
+                return isdigit(syscall[0]) ?
+                    sdb::to_integral<int>(syscall).value() :
+                    sdb::syscall_name_to_id(syscall);
+            });
+        return ids;
+    }
+
     void handle_syscall_catchpoint_command(
         sdb::process& process, const std::vector<std::string>& args) {
         sdb::syscall_catch_policy policy =
@@ -565,17 +911,8 @@ syscall <list of syscall IDs or names>
             policy = sdb::syscall_catch_policy::catch_none();
         }
         else if (args.size() >= 3) {
-            auto syscalls = split(args[2], ',');
-            std::vector<int> to_catch;
-            std::transform(begin(syscalls), end(syscalls),
-                std::back_inserter(to_catch),
-                [](auto& syscall) {
-                    return isdigit(syscall[0]) ?
-                        sdb::to_integral<int>(syscall).value() :
-                        sdb::syscall_name_to_id(syscall);
-                });
-            policy =
-                sdb::syscall_catch_policy::catch_some(std::move(to_catch));
+            policy = sdb::syscall_catch_policy::catch_some(
+                parse_syscall_list(args[2]));
         }
 
         process.set_syscall_catch_policy(std::move(policy));
@@ -593,6 +930,91 @@ syscall <list of syscall IDs or names>
         }
     }
 
+    void handle_thread_command(
+        sdb::process& process, const std::vector<std::string>& args) {
+        if (args.size() < 2) {
+            print_help({ "help", "thread" });
+            return;
+        }
+
+        if (is_prefix(args[1], "list")) {
+            for (auto& [tid, thread] : process.threads()) {
+                auto marker = tid == process.current_thread() ? '*' : ' ';
+                auto state = thread.state == sdb::process_state::running ?
+                    "running" : "stopped";
+                fmt::print("{} {}: {}\n", marker, tid, state);
+            }
+        }
+        else if (is_prefix(args[1], "select") and args.size() == 3) {
+            auto tid = sdb::to_integral<pid_t>(args[2]);
+            if (!tid) {
+                std::cerr << "Command expects thread id\n";
+                return;
+            }
+            process.set_current_thread(*tid);
+        }
+        else if (is_prefix(args[1], "mode") and args.size() == 3) {
+            if (args[2] == "all-stop") {
+                process.set_stop_mode(sdb::stop_mode::all_stop);
+            }
+            else if (args[2] == "non-stop") {
+                process.set_stop_mode(sdb::stop_mode::non_stop);
+            }
+            else {
+                print_help({ "help", "thread" });
+            }
+        }
+        else {
+            print_help({ "help", "thread" });
+        }
+    }
+
+    void handle_checkpoint_command(
+        sdb::process& process, const std::vector<std::string>& args) {
+        if (args.size() == 1) {
+            auto id = process.checkpoint();
+            fmt::print("Checkpoint {} at {:#018x}\n",
+                id, process.get_pc().addr());
+            return;
+        }
+
+        if (is_prefix(args[1], "list")) {
+            auto checkpoints = process.checkpoints();
+            if (checkpoints.empty()) {
+                fmt::print("No checkpoints saved\n");
+                return;
+            }
+            for (auto& checkpoint : checkpoints) {
+                fmt::print("{}: pid = {}, pc = {:#018x}\n", checkpoint.id,
+                    checkpoint.pid, checkpoint.pc.addr());
+            }
+        }
+        else if (is_prefix(args[1], "delete") and args.size() == 3) {
+            auto id = sdb::to_integral<int>(args[2]);
+            if (!id) {
+                std::cerr << "Command expects checkpoint id\n";
+                return;
+            }
+            process.delete_checkpoint(*id);
+        }
+        else {
+            print_help({ "help", "checkpoint" });
+        }
+    }
+
+    void handle_restart_command(
+        sdb::process& process, const std::vector<std::string>& args) {
+        std::optional<int> id;
+        if (args.size() == 2) id = sdb::to_integral<int>(args[1]);
+        if (!id) {
+            std::cerr << "Command expects checkpoint id\n";
+            return;
+        }
+        process.restart(*id);
+        fmt::print("Restarted from checkpoint {} as process {} at {:#018x}\n",
+            *id, process.pid(), process.get_pc().addr());
+    }
+
     void handle_command(
             std::unique_ptr<sdb::process>& process,
             std::string_view line) {
@@ -616,6 +1038,14 @@ syscall <list of syscall IDs or names>
             auto reason = process->step_instruction();
             handle_stop(*process, reason);
         }
+        else if (is_prefix(command, "next")) {
+            auto reason = process->step_over();
+            handle_stop(*process, reason);
+        }
+        else if (is_prefix(command, "finish")) {
+            auto reason = process->step_out();
+            handle_stop(*process, reason);
+        }
         else if (is_prefix(command, "disassemble")) {
             handle_disassemble_command(*process, args);
         }
@@ -631,11 +1061,302 @@ syscall <list of syscall IDs or names>
         else if (is_prefix(command, "catchpoint")) {
             handle_catchpoint_command(*process, args);
         }
+        else if (is_prefix(command, "thread")) {
+            handle_thread_command(*process, args);
+        }
+        else if (is_prefix(command, "tracepoint")) {
+            handle_tracepoint_command(*process, args);
+        }
+        else if (is_prefix(command, "checkpoint")) {
+            handle_checkpoint_command(*process, args);
+        }
+        else if (is_prefix(command, "restart")) {
+            handle_restart_command(*process, args);
+        }
         else {
             std::cerr << "Unknown command\n";
         }
     }
 
+    // Ctrl-C ends the non-interactive modes, which then print what they
+    // collected
+    volatile std::sig_atomic_t g_interrupted = 0;
+    void handle_batch_sigint(int) {
+        g_interrupted = 1;
+    }
+    // The tracer blocks in waitpid, so also wake it with a stop
+    void handle_trace_sigint(int) {
+        g_interrupted = 1;
+        kill(g_sdb_process->pid(), SIGSTOP);
+    }
+
+    // sdb profile <pid> [--hz N] [--duration S]
+    // Writes folded stacks to stdout once the process exits, the duration
+    // runs out or the user presses Ctrl-C
+    int run_profiler(int argc, const char** argv) {
+        if (argc < 3) {
+            std::cerr << "Usage: sdb profile <pid> [--hz N] [--duration S]\n";
+            return -1;
+        }
+        auto pid = sdb::to_integral<pid_t>(argv[2]);
+        unsigned hz = 99;
+        std::optional<std::chrono::nanoseconds> duration;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string_view flag = argv[i];
+            if (flag == "--hz") {
+                auto value = sdb::to_integral<unsigned>(argv[i + 1]);
+                if (!value or *value == 0) sdb::error::send("Invalid rate");
+                hz = *value;
+            }
+            else if (flag == "--duration") {
+                auto value = sdb::to_float<double>(argv[i + 1]);
+                if (!value or *value <= 0) sdb::error::send("Invalid duration");
+                duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::duration<double>(*value));
+            }
+            else {
+                sdb::error::send(fmt::format("Unknown option {}", flag));
+            }
+        }
+        if (!pid) sdb::error::send("Invalid PID");
+
+        auto process = sdb::process::seize(*pid);
+        signal(SIGINT, handle_batch_sigint);
+
+        sdb::profiler profiler(*process);
+        profiler.run(hz, duration, [] { return g_interrupted != 0; });
+        profiler.write_folded(std::cout);
+        std::cerr << fmt::format("{} samples\n", profiler.sample_count());
+        return 0;
+    }
+
+    void print_syscall_record(const sdb::syscall_record& record) {
+        auto name = sdb::syscall_id_to_name(record.info.id);
+        auto prefix = fmt::format("{:>12.6f} [{}]",
+            record.timestamp / 1e9, record.tid);
+        if (record.info.entry) {
+            fmt::print("{} {}({:#x})\n",
+                prefix, name, fmt::join(record.info.args, ", "));
+        }
+        else {
+            fmt::print("{} {} = {}\n", prefix, name, record.info.ret);
+        }
+    }
+
+    void print_latency_histogram(
+        int id, const sdb::latency_histogram& histogram) {
+        fmt::print("{}: {} calls, avg {} ns, min {} ns, max {} ns\n",
+            sdb::syscall_id_to_name(id), histogram.count,
+            histogram.total / histogram.count, histogram.min, histogram.max);
+
+        auto& buckets = histogram.buckets;
+        auto first = std::find_if(begin(buckets), end(buckets),
+            [](auto n) { return n != 0; });
+        auto last = std::find_if(rbegin(buckets), rend(buckets),
+            [](auto n) { return n != 0; }).base();
+        auto peak = *std::max_element(first, last);
+        for (auto it = first; it != last; ++it) {
+            auto low = std::uint64_t{1} << (it - begin(buckets));
+            if (it == begin(buckets)) low = 0;
+            auto high = std::uint64_t{1} << (it - begin(buckets) + 1);
+            fmt::print("  [{:>10}, {:>10}) {:>8} |{:<40}|\n", low, high, *it,
+                std::string(*it * 40 / peak, '@'));
+        }
+    }
+
+    // sdb trace [-e <syscalls>] [--buffer N] [--summary] <program>|-p <pid>
+    // Records syscalls into a ring buffer and only formats them once
+    // tracing ends, followed by a latency histogram per syscall. -e only
+    // gets a seccomp filter for launched programs
+    int run_tracer(int argc, const char** argv) {
+        std::optional<std::vector<int>> to_catch;
+        std::size_t capacity = 1 << 16;
+        bool summary_only = false;
+        std::optional<pid_t> pid;
+        const char* program = nullptr;
+        for (int i = 2; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "-e" and has_value) {
+                to_catch = parse_syscall_list(argv[++i]);
+            }
+            else if (arg == "--buffer" and has_value) {
+                auto value = sdb::to_integral<std::size_t>(argv[++i]);
+                if (!value) sdb::error::send("Invalid buffer size");
+                capacity = *value;
+            }
+            else if (arg == "--summary") {
+                summary_only = true;
+            }
+            else if (arg == "-p" and has_value) {
+                pid = sdb::to_integral<pid_t>(argv[++i]);
+                if (!pid) sdb::error::send("Invalid PID");
+            }
+            else if (!program and arg[0] != '-') {
+                program = argv[i];
+            }
+            else {
+                sdb::error::send(fmt::format("Unknown option {}", arg));
+            }
+        }
+        if (!pid and !program) {
+            std::cerr << "Usage: sdb trace [-e <syscalls>] [--buffer N] "
+                "[--summary] <program>|-p <pid>\n";
+            std::cerr << "-e filters in the kernel for launched programs, "
+                "but -p stops on every syscall\n";
+            return -1;
+        }
+
+        auto policy = to_catch ?
+            sdb::syscall_catch_policy::catch_some(*to_catch) :
+            sdb::syscall_catch_policy::catch_all();
+        std::unique_ptr<sdb::process> process;
+        if (pid) {
+            process = sdb::process::attach(*pid);
+            process->set_syscall_catch_policy(std::move(policy));
+        }
+        else {
+            process = sdb::process::launch(
+                program, true, std::nullopt, std::move(policy));
+        }
+        g_sdb_process = process.get();
+        signal(SIGINT, handle_trace_sigint);
+
+        sdb::syscall_tracer tracer(*process, capacity);
+        tracer.run([] { return g_interrupted != 0; });
+
+        auto& records = tracer.records();
+        if (!summary_only) {
+            if (records.dropped() != 0) {
+                fmt::print("({} earlier events dropped)\n", records.dropped());
+            }
+            for (std::size_t i = 0; i < records.size(); ++i) {
+                print_syscall_record(records[i]);
+            }
+        }
+        for (auto& [id, histogram] : tracer.latencies()) {
+            print_latency_histogram(id, histogram);
+        }
+        if (auto& reason = tracer.exit_reason()) {
+            print_stop_reason(*process, *reason);
+        }
+        return 0;
+    }
+
+    void print_call_latencies(
+        sdb::virt_addr function, pid_t tid,
+        const sdb::hdr_histogram& histogram) {
+        fmt::print("{:#018x} in thread {}: {} calls, avg {} ns, "
+            "min {} ns, max {} ns\n", function.addr(), tid, histogram.count(),
+            histogram.mean(), histogram.min(), histogram.max());
+        for (auto fraction : { 0.5, 0.9, 0.99, 0.999 }) {
+            fmt::print("  p{:<6} {:>12} ns\n", fraction * 100,
+                histogram.percentile(fraction));
+        }
+    }
+
+    // sdb latency <address>[,<address>...] <program>|-p <pid>
+    // Times every call to the functions starting at the given addresses
+    // and prints their latency percentiles per thread once tracing ends
+    int run_latency(int argc, const char** argv) {
+        std::vector<sdb::virt_addr> functions;
+        std::optional<pid_t> pid;
+        const char* program = nullptr;
+        for (int i = 2; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            if (arg == "-p" and i + 1 < argc) {
+                pid = sdb::to_integral<pid_t>(argv[++i]);
+                if (!pid) sdb::error::send("Invalid PID");
+            }
+            else if (functions.empty() and arg[0] != '-') {
+                for (auto& text : split(arg, ',')) {
+                    auto address = sdb::to_integral<std::uint64_t>(text, 16);
+                    if (!address) sdb::error::send("Invalid address format");
+                    functions.push_back(sdb::virt_addr{ *address });
+                }
+            }
+            else if (!program and arg[0] != '-') {
+                program = argv[i];
+            }
+            else {
+                sdb::error::send(fmt::format("Unknown option {}", arg));
+            }
+        }
+        if (functions.empty() or (!pid and !program)) {
+            std::cerr << "Usage: sdb latency <address>[,<address>...] "
+                "<program>|-p <pid>\n";
+            return -1;
+        }
+
+        auto process = pid ?
+            sdb::process::attach(*pid) : sdb::process::launch(program);
+        g_sdb_process = process.get();
+        signal(SIGINT, handle_trace_sigint);
+
+        sdb::latency_tracer tracer(*process);
+        for (auto function : functions) tracer.trace(function);
+        tracer.run([] { return g_interrupted != 0; });
+
+        for (auto& [function, threads] : tracer.latencies()) {
+            for (auto& [tid, histogram] : threads) {
+                print_call_latencies(function, tid, histogram);
+            }
+        }
+        if (auto& reason = tracer.exit_reason()) {
+            print_stop_reason(*process, *reason);
+        }
+        return 0;
+    }
+
+    // sdb coverage <program> [-o <bitmap file>] [--blocks <file>]
+    // Runs the program once and writes one bit per basic block of the main
+    // executable, with the block addresses optionally listed alongside
+    int run_coverage(int argc, const char** argv) {
+        const char* program = nullptr;
+        std::string bitmap_path = "coverage.bitmap";
+        std::optional<std::string> blocks_path;
+        for (int i = 2; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "-o" and has_value) {
+                bitmap_path = argv[++i];
+            }
+            else if (arg == "--blocks" and has_value) {
+                blocks_path = argv[++i];
+            }
+            else if (!program and arg[0] != '-') {
+                program = argv[i];
+            }
+            else {
+                sdb::error::send(fmt::format("Unknown option {}", arg));
+            }
+        }
+        if (!program) {
+            std::cerr << "Usage: sdb coverage <program> [-o <bitmap file>] "
+                "[--blocks <file>]\n";
+            return -1;
+        }
+
+        auto process = sdb::process::launch(program);
+        sdb::coverage coverage(*process);
+        coverage.instrument();
+        auto reason = coverage.run();
+
+        std::ofstream bitmap(bitmap_path, std::ios::binary);
+        coverage.write_bitmap(bitmap);
+        if (blocks_path) {
+            std::ofstream blocks(*blocks_path);
+            for (auto address : coverage.blocks()) {
+                blocks << fmt::format("{:#x}\n", address.addr());
+            }
+        }
+
+        print_stop_reason(*process, reason);
+        fmt::print("Covered {} of {} basic blocks\n",
+            coverage.covered_count(), coverage.blocks().size());
+        return 0;
+    }
+
     std::unique_ptr<sdb::process> attach(int argc, const char** argv) {
         // Passing PID
         if (argc == 3 && argv[1] == std::string_view("-p")) {
@@ -687,6 +1408,18 @@ int main(int argc, const char** argv) {
     }
     
     try {
+        if (argv[1] == std::string_view("profile")) {
+            return run_profiler(argc, argv);
+        }
+        if (argv[1] == std::string_view("trace")) {
+            return run_tracer(argc, argv);
+        }
+        if (argv[1] == std::string_view("coverage")) {
+            return run_coverage(argc, argv);
+        }
+        if (argv[1] == std::string_view("latency")) {
+            return run_latency(argc, argv);
+        }
         auto process = attach(argc, argv);
         g_sdb_process = process.get();
         signal(SIGINT, handle_sigint);